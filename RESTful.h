@@ -1,7 +1,11 @@
 #pragma once
+#if defined(RESTFUL_POSIX)
+#include "rfposix.h"
+#else
 #include <Arduino.h>
 #include <SPI.h>
 #include <Ethernet.h>
+#endif
 #include "rfutil.h"
 
 /*
@@ -9,7 +13,7 @@
  * 
  * Written in 2017 by pr0ximo (prodeveloper0's moniker)
  * Published in 2019 by prodeveloper0
- * Version 0.4.1
+ * Version 0.4.26
  * 
  * Changelog
  * Version 0.1.0: First version
@@ -26,6 +30,31 @@
  * Version 0.3.6: Add function to reduce SRAM consumption
  * Version 0.4.0: Change buffer policy to reduce memory fragmentation
  * Version 0.4.1: Self code static analysis and security bug fix
+ * Version 0.4.2: Add route index to find handler in O(path segments)
+ * Version 0.4.3: Receive request by blocks instead of byte-at-a-time
+ * Version 0.4.4: Coalesce response into buffer and send it by blocks
+ * Version 0.4.5: Add HTTP/1.1 persistent connection
+ * Version 0.4.6: Add non-blocking request processing
+ * Version 0.4.7: Serve multiple clients concurrently
+ * Version 0.4.8: Index request header fields and match keys case-insensitively
+ * Version 0.4.9: Add non-allocating value views and typed accessors
+ * Version 0.4.10: Add streaming request body reader driven by Content-Length
+ * Version 0.4.11: Add streaming response with chunked transfer-encoding
+ * Version 0.4.12: Make utility functions inline, take client type from RESTFUL_CLIENT and build on host
+ * Version 0.4.13: Add optional metrics served in Prometheus text format
+ * Version 0.4.14: Add route table placed in flash memory with method enum
+ * Version 0.4.15: Answer 405, 501, HEAD and OPTIONS without running handler
+ * Version 0.4.16: Add response cache with ETag and 304 Not Modified
+ * Version 0.4.17: Add body writer backed by fixed area of buffer instead of heap
+ * Version 0.4.18: Reject oversized and stalled requests with 408, 413, 414, 431 and support 100-continue
+ * Version 0.4.19: Serve static assets from flash memory by blocks
+ * Version 0.4.20: Add POSIX socket transport and epoll server
+ * Version 0.4.21: Drop header fields not in allowlist while receiving request
+ * Version 0.4.22: Add WebSocket upgrade and frame API
+ * Version 0.4.23: Add Server-Sent Events routes and broadcast to subscribers
+ * Version 0.4.24: Add deferred handlers resumed by later poll calls
+ * Version 0.4.25: Keep pipelined requests in receive buffer and answer them in order
+ * Version 0.4.26: Add optional batch endpoint running many route calls in one request
  * 
  */
 
@@ -63,6 +92,8 @@
 #define HTTP_415_UNSUPPORTED_MEDIA_TYPE           F("HTTP/1.1 415 Unsupported Media Type\r\n")
 #define HTTP_416_REQUESTED_RANGE_NOT_SATISFIABLE  F("HTTP/1.1 416 Requested range not satisfiable\r\n")
 #define HTTP_417_EXPECTATION_FAILED               F("HTTP/1.1 417 Expectation Failed\r\n")
+#define HTTP_426_UPGRADE_REQUIRED                 F("HTTP/1.1 426 Upgrade Required\r\n")
+#define HTTP_431_REQUEST_HEADER_FIELDS_TOO_LARGE  F("HTTP/1.1 431 Request Header Fields Too Large\r\n")
 #define HTTP_500_INTERNAL_SERVER_ERROR            F("HTTP/1.1 500 Internal Server Error\r\n")
 #define HTTP_501_NOT_IMPLEMENTED                  F("HTTP/1.1 501 Not Implemented\r\n")
 #define HTTP_502_BAD_GATEWAY                      F("HTTP/1.1 502 Bad Gateway\r\n")
@@ -71,6 +102,138 @@
 #define HTTP_505_HTTP_VERSION_NOT_SUPPORTED       F("HTTP/1.1 505 HTTP Version not supported\r\n")
 #define HTTP_END_OF_REQUEST                       F("\r\n")
 
+// Transport client needs available, read, write, connected and stop like EthernetClient
+#ifndef RESTFUL_CLIENT
+#define RESTFUL_CLIENT                            EthernetClient
+#endif
+typedef RESTFUL_CLIENT RESTCLIENT;
+
+#define RESTFUL_ERROR                             -1
+#define RESTFUL_NEED_MORE                         0
+#define RESTFUL_DISPATCHED                        1
+#define RESTFUL_CLOSED                            2
+#define RESTFUL_UPGRADED                          3
+
+#ifndef RESTFUL_HEADER_FIELDS
+#define RESTFUL_HEADER_FIELDS                     16
+#endif
+
+// Query and parameter values decoded in place per request, further ones are returned as received
+#ifndef RESTFUL_DECODED_VALUES
+#define RESTFUL_DECODED_VALUES                    4
+#endif
+
+// Pipelined bytes are kept only when this much of buffer is left for response
+#ifndef RESTFUL_TRANSMIT_MIN_SIZE
+#define RESTFUL_TRANSMIT_MIN_SIZE                 64
+#endif
+
+
+/*
+ * Header field
+ * 
+ * Offsets of key and value in header buffer with hash of lowercase key.
+ */
+typedef struct _HEADERFIELD_ {
+  unsigned short key;
+  unsigned short value;
+  unsigned short valuesz;
+  unsigned char keysz;
+  unsigned char hash;
+} HEADERFIELD;
+
+
+/*
+ * Value view
+ * 
+ * Pointer and length of value in request buffer, str is NULL if value is missing.
+ */
+typedef struct _RESTVIEW_ {
+  char* str;
+  int len;
+} RESTVIEW;
+
+// Value decoded in place keeps spanning its encoded length, so nothing behind it moves
+typedef struct _RESTDECODED_ {
+  char* str;
+  unsigned short len;
+  unsigned short decsz;
+} RESTDECODED;
+
+
+/*
+ * HTTP method
+ * 
+ * 
+ */
+typedef enum _RESTMETHOD_ {
+  REST_UNKNOWN = 0,
+  REST_GET,
+  REST_HEAD,
+  REST_POST,
+  REST_PUT,
+  REST_DELETE,
+  REST_CONNECT,
+  REST_OPTIONS,
+  REST_TRACE,
+  REST_PATCH
+} RESTMETHOD;
+
+// Classify method by its first byte, then compare whole name
+inline RESTMETHOD _parsemethod(const char* s) {
+  switch (s[0]) {
+  case 'G':
+    return (!strcmp_P(s, PSTR("GET"))) ? (REST_GET) : (REST_UNKNOWN);
+  case 'H':
+    return (!strcmp_P(s, PSTR("HEAD"))) ? (REST_HEAD) : (REST_UNKNOWN);
+  case 'P':
+    if (s[1] == 'O')
+      return (!strcmp_P(s, PSTR("POST"))) ? (REST_POST) : (REST_UNKNOWN);
+    if (s[1] == 'U')
+      return (!strcmp_P(s, PSTR("PUT"))) ? (REST_PUT) : (REST_UNKNOWN);
+    return (!strcmp_P(s, PSTR("PATCH"))) ? (REST_PATCH) : (REST_UNKNOWN);
+  case 'D':
+    return (!strcmp_P(s, PSTR("DELETE"))) ? (REST_DELETE) : (REST_UNKNOWN);
+  case 'C':
+    return (!strcmp_P(s, PSTR("CONNECT"))) ? (REST_CONNECT) : (REST_UNKNOWN);
+  case 'O':
+    return (!strcmp_P(s, PSTR("OPTIONS"))) ? (REST_OPTIONS) : (REST_UNKNOWN);
+  case 'T':
+    return (!strcmp_P(s, PSTR("TRACE"))) ? (REST_TRACE) : (REST_UNKNOWN);
+  }
+  
+  return REST_UNKNOWN;
+}
+
+inline const __FlashStringHelper* _methodname(RESTMETHOD method) {
+  switch (method) {
+  case REST_GET:
+    return F("GET");
+  case REST_HEAD:
+    return F("HEAD");
+  case REST_POST:
+    return F("POST");
+  case REST_PUT:
+    return F("PUT");
+  case REST_DELETE:
+    return F("DELETE");
+  case REST_CONNECT:
+    return F("CONNECT");
+  case REST_OPTIONS:
+    return F("OPTIONS");
+  case REST_TRACE:
+    return F("TRACE");
+  case REST_PATCH:
+    return F("PATCH");
+  default:
+    return F("");
+  }
+}
+
+
+typedef bool (*RESTBODYCALLBACK)(const char*, int, void*);
+typedef int (*RESTSTREAMCALLBACK)(char*, int, void*);
+
 
 /*
  * Header
@@ -79,10 +242,14 @@
  */
 class Header {
 friend class RESTful;
+friend struct _RESTDEFERRED_;
+friend struct _RESTBATCH_;
 private:
   char* _buf;
   int _bufsz;
   int _pos;
+  HEADERFIELD* _fields;
+  int _nfields;
   
 private:
   void setbuf(char* buf, int bufsz) {
@@ -91,11 +258,109 @@ private:
     this->_pos = strlen(buf);
   }
   
+  // Build field table once, lookups fall back to scanning if header has too many fields
+  void index(HEADERFIELD* fields, int fieldsz) {
+    HEADERFIELD f;
+    int i = 0;
+    int n = 0;
+    
+    this->_fields = fields;
+    this->_nfields = -1;
+    
+    if (this->transmissible()) {
+      while ((i = this->field(i, &f)) != -1) {
+        if (n >= fieldsz)
+          return;
+        fields[n++] = f;
+      }
+    }
+    
+    this->_nfields = n;
+  }
+  
+  // Parse field line from offset, returns offset of next line or -1 at end of header
+  int field(int i, HEADERFIELD* f) const {
+    while (this->_buf[i] != '\0') {
+      int lcnt = _struntil(&this->_buf[i], '\n');
+      int kcnt = _struntil(&this->_buf[i], ':');
+      
+      if (kcnt < lcnt && kcnt <= 0xFF) {
+        int v = i + kcnt + 1;
+        int e = i + lcnt;
+        
+        while (v < e && (this->_buf[v] == ' ' || this->_buf[v] == '\t'))
+          ++v;
+        while (e > v && (this->_buf[e - 1] == '\r' || this->_buf[e - 1] == ' ' || this->_buf[e - 1] == '\t'))
+          --e;
+        
+        f->key = i;
+        f->keysz = kcnt;
+        f->hash = _strhash(&this->_buf[i], kcnt);
+        f->value = v;
+        f->valuesz = e - v;
+        return (this->_buf[i + lcnt] == '\0') ? (i + lcnt) : (i + lcnt + 1);
+      }
+      
+      i += lcnt;
+      if (this->_buf[i] == '\n')
+        ++i;
+    }
+    
+    return -1;
+  }
+  
+  bool match(const HEADERFIELD* f, const char* key, int keysz, unsigned char hash, bool progmem) const {
+    if (f->keysz != keysz || f->hash != hash)
+      return false;
+    
+    return (progmem) ?
+      (!strncasecmp_P(&this->_buf[f->key], key, keysz)) :
+      (!strncasecmp(&this->_buf[f->key], key, keysz));
+  }
+  
+  bool find(const char* key, bool progmem, HEADERFIELD* f) const {
+    int keysz = (progmem) ? (strlen_P(key)) : (strlen(key));
+    unsigned char hash = (progmem) ?
+      (_strhash_P((const __FlashStringHelper*)key, keysz)) : (_strhash(key, keysz));
+    
+    if (!this->transmissible())
+      return false;
+    
+    if (this->_nfields >= 0) {
+      for (int k = 0;k < this->_nfields;++k) {
+        if (this->match(&this->_fields[k], key, keysz, hash, progmem)) {
+          *f = this->_fields[k];
+          return true;
+        }
+      }
+      return false;
+    }
+    
+    for (int i = 0;(i = this->field(i, f)) != -1;) {
+      if (this->match(f, key, keysz, hash, progmem))
+        return true;
+    }
+    
+    return false;
+  }
+  
+  String value(const HEADERFIELD* f) const {
+    String value;
+    
+    value.reserve(f->valuesz);
+    for (int j = 0;j < f->valuesz;++j)
+      value += this->_buf[f->value + j];
+    
+    return value;
+  }
+  
 private:
   Header() {
     this->_buf = NULL;
     this->_bufsz = 0;
     this->_pos = 0;
+    this->_fields = NULL;
+    this->_nfields = -1;
   }
   
 private:
@@ -158,6 +423,21 @@ public:
     this->_pos += (keysz + valuesz + 4);
   }
   
+  void set(const __FlashStringHelper* key, const char* value) {
+    int keysz = strlen_P((char*)key);
+    int valuesz = strlen(value);
+    
+    if ((keysz + valuesz + 5) > (_bufsz - _pos))
+      return;
+    
+    strcat_P(this->_buf, (char*)key);
+    strcat_P(this->_buf, (char*)(F(": ")));
+    strcat(this->_buf, value);
+    strcat_P(this->_buf, (char*)(F("\r\n")));
+    
+    this->_pos += (keysz + valuesz + 4);
+  }
+  
   void set(const __FlashStringHelper* key, const __FlashStringHelper* value) {
     int keysz = strlen_P((char*)key);
     int valuesz = strlen_P((char*)value);
@@ -173,57 +453,48 @@ public:
     this->_pos += (keysz + valuesz + 4);
   }
   
-  // Getting specific header field value
+  // Getting specific header field value, key is case-insensitive
   String get(const String& key) {
-    int i = 0;
-    String value;
+    HEADERFIELD f;
     
-    do {
-      if (!this->transmissible())
-        break;
-      
-      int kcnt = _struntil(&this->_buf[i], ':');
-      int vcnt = _struntil(&this->_buf[2 + i + kcnt], '\r');
-      
-      if(_strcmp(&this->_buf[i], key.c_str(), ':')) {
-        value = String();
-        value.reserve(vcnt);
-        
-        for(int j = 0;j < vcnt;++j)
-          value += this->_buf[2 + i + kcnt + j];
-        break;
-      }
-      
-      i += 3 + kcnt + vcnt;
-    } while(this->_buf[i++] != '\0');
+    if (!this->find(key.c_str(), false, &f))
+      return String();
     
-    return value;
+    return this->value(&f);
   }
   
   String get(const __FlashStringHelper* key) {
-    int i = 0;
-    String value;
+    HEADERFIELD f;
     
-    do {
-      if (!this->transmissible())
-        break;
-      
-      int kcnt = _struntil(&this->_buf[i], ':');
-      int vcnt = _struntil(&this->_buf[2 + i + kcnt], '\r');
-      
-      if(_strcmp_P(&this->_buf[i], key, ':')) {
-        value = String();
-        value.reserve(vcnt);
-        
-        for(int j = 0;j < vcnt;++j)
-          value += this->_buf[2 + i + kcnt + j];
-        break;
-      }
-      
-      i += 3 + kcnt + vcnt;
-    } while(this->_buf[i++] != '\0');
+    if (!this->find((const char*)key, true, &f))
+      return String();
     
-    return value;
+    return this->value(&f);
+  }
+  
+  // Getting specific header field value without allocation
+  RESTVIEW get_view(const char* key) const {
+    HEADERFIELD f;
+    RESTVIEW v = { NULL, 0 };
+    
+    if (this->find(key, false, &f)) {
+      v.str = &this->_buf[f.value];
+      v.len = f.valuesz;
+    }
+    
+    return v;
+  }
+  
+  RESTVIEW get_view(const __FlashStringHelper* key) const {
+    HEADERFIELD f;
+    RESTVIEW v = { NULL, 0 };
+    
+    if (this->find((const char*)key, true, &f)) {
+      v.str = &this->_buf[f.value];
+      v.len = f.valuesz;
+    }
+    
+    return v;
   }
 };
 
@@ -235,14 +506,29 @@ public:
  */
 class Request {
 friend class RESTful;
+friend struct _RESTDEFERRED_;
 private:
   char* _method;
+  RESTMETHOD _methodid;
   char* _url;
   char* _query;
-  char* _url_format;
+  const char* _url_format;
+  bool _url_format_P;
   char* _protocol_version;
+  char* _body;
+  int _bodysz;
+  int _bodypos;
+  long _length;
+  long _remaining;
+  unsigned long _bodytimeout;
+  unsigned long _bodybegin;
+  RESTCLIENT* _client;
   bool _failed;
+  unsigned char _state;
   Header* _hdr;
+  HEADERFIELD _fields[RESTFUL_HEADER_FIELDS];
+  RESTDECODED _decoded[RESTFUL_DECODED_VALUES];
+  int _decodedsz;
   
 private:
   void setbuf(char* str) {
@@ -253,6 +539,7 @@ private:
     this->_method = strtok(line, " ");
     if (this->_method == NULL)
       return;
+    this->_methodid = _parsemethod(this->_method);
     
     // URL parsing
     this->_url = strtok(NULL, " ");
@@ -276,14 +563,26 @@ private:
   }
   
 private:
-  Request(const Header* ihdr) {
+  Request(Header* ihdr) {
     this->_method = NULL;
+    this->_methodid = REST_UNKNOWN;
     this->_url = NULL;
     this->_query = NULL;
     this->_url_format = NULL;
+    this->_url_format_P = false;
     this->_protocol_version = NULL;
+    this->_body = NULL;
+    this->_bodysz = 0;
+    this->_bodypos = 0;
+    this->_length = -1;
+    this->_remaining = 0;
+    this->_bodytimeout = 0;
+    this->_bodybegin = 0;
+    this->_client = NULL;
     this->_failed = true;
+    this->_state = 0;
     this->_hdr = ihdr;
+    this->_decodedsz = 0;
   }
   
 public:
@@ -291,10 +590,19 @@ public:
     return this->_failed;
   }
   
+  // State given to Response::defer by previous call of deferred handler, 0 on first call
+  unsigned char state() const {
+    return this->_state;
+  }
+  
   char* method() const {
     return this->_method;
   }
   
+  RESTMETHOD method_id() const {
+    return this->_methodid;
+  }
+  
   char* url() const {
     return this->_url;
   }
@@ -311,365 +619,3373 @@ public:
     return this->_hdr;
   }
   
-private:
-  char* url_format() const {
-    return this->_url_format;
+  // Part of HTTP body received together with header, rest is still in client
+  char* body() const {
+    return this->_body;
   }
   
-  void url_format(char* url_format) {
-    this->_url_format = url_format;
+  int body_length() const {
+    return this->_bodysz;
   }
   
-public:
-  // Getting specific URL query value
-  String query(const String& key) {
-    int i = 0;
-    String value;
+  // Content-Length of request, -1 if it is not given
+  long content_length() const {
+    return this->_length;
+  }
+  
+  // Bytes of body not read yet
+  long remaining() const {
+    return this->_remaining;
+  }
+  
+  // Read at most n bytes of body, returns 0 at end of body and -1 on timeout
+  // Timeout counts from dispatch of request, so trickling peer can not hold handler longer
+  int read(char* buf, int n) {
+    if (n > this->_remaining)
+      n = this->_remaining;
+    if (n <= 0)
+      return 0;
     
-    do {
-      if (this->_failed)
-        break;
+    // Part received together with header is consumed first
+    if (this->_bodypos < this->_bodysz) {
+      int m = min(n, this->_bodysz - this->_bodypos);
       
-      int kcnt = _struntil(&this->_query[i], '=');
-      int vcnt = _struntil(&this->_query[1 + i + kcnt], '&');
+      memcpy(buf, &this->_body[this->_bodypos], m);
+      this->_bodypos += m;
+      this->_remaining -= m;
+      return m;
+    }
+    
+    while (this->_client != NULL && !timeover(this->_bodybegin, this->_bodytimeout)) {
+      int m = this->_client->available();
       
-      if(_strcmp(&this->_query[i], key.c_str(), '=')) {
-        value = String();
-        value.reserve(vcnt);
-        
-        for(int j = 0;j < vcnt;++j)
-          value += this->_query[i + kcnt + 1 + j];
-        break;
+      if (m > 0) {
+        m = this->_client->read((uint8_t*)buf, min(n, m));
+        if (m > 0) {
+          this->_remaining -= m;
+          return m;
+        }
       }
       
-      i += kcnt + 1 + vcnt;
-    } while(this->_query[i++] != '\0');
+      if (!this->_client->connected())
+        break;
+    }
     
-    return value;
+    return -1;
   }
   
-  String query(const __FlashStringHelper* key) {
-    int i = 0;
-    String value;
-    
-    do {
-      if (this->_failed)
-        break;
+  // Pass body to callback block by block, stops when callback returns false
+  // Returns true if whole body was received
+  bool receive(char* buf, int bufsz, RESTBODYCALLBACK callback, void* context) {
+    while (this->_remaining > 0) {
+      int n;
       
-      int kcnt = _struntil(&this->_query[i], '=');
-      int vcnt = _struntil(&this->_query[1 + i + kcnt], '&');
-      
-      if(_strcmp_P(&this->_query[i], key, '=')) {
-        value = String();
-        value.reserve(vcnt);
+      if (this->_bodypos < this->_bodysz) {
+        n = min((long)(this->_bodysz - this->_bodypos), this->_remaining);
+        if (!callback(&this->_body[this->_bodypos], n, context))
+          return false;
         
-        for(int j = 0;j < vcnt;++j)
-          value += this->_query[i + kcnt + 1 + j];
-        break;
+        this->_bodypos += n;
+        this->_remaining -= n;
+        continue;
       }
       
-      i += kcnt + 1 + vcnt;
-    } while(this->_query[i++] != '\0');
+      n = this->read(buf, bufsz);
+      if (n <= 0 || !callback(buf, n, context))
+        return false;
+    }
+    
+    return true;
+  }
+  
+private:
+  const char* url_format() const {
+    return this->_url_format;
+  }
+  
+  // Format of RESTROUTE stays in flash and is read by pgm_read_byte
+  void url_format(const char* url_format, bool progmem = false) {
+    this->_url_format = url_format;
+    this->_url_format_P = progmem;
+  }
+  
+  char formatat(int i) const {
+    return (this->_url_format_P) ? (pgm_read_byte(&this->_url_format[i])) : (this->_url_format[i]);
+  }
+  
+  // Compare name of ':param' segment at i with key of keysz characters
+  bool paramat(int i, const char* key, int keysz, bool progmem) const {
+    const __FlashStringHelper* f = (const __FlashStringHelper*)&this->_url_format[i];
+    
+    if (this->_url_format_P)
+      return (progmem) ? (_strcmp_P(f, (const __FlashStringHelper*)key, '/')) : (_strcmp_P(f, key, '/'));
+    
+    return !((progmem) ?
+      (strncmp_P(&this->_url_format[i], key, keysz)) : (strncmp(&this->_url_format[i], key, keysz)));
+  }
+  
+private:
+  static String tostring(const RESTVIEW& v) {
+    String value;
+    
+    if (v.str == NULL)
+      return value;
+    
+    value.reserve(v.len);
+    for (int j = 0;j < v.len;++j)
+      value += v.str[j];
     
     return value;
   }
   
-  // Getting specific URL parameter value
-  String parameter(const String& key) {
+  // Decoded value starting at s, NULL if it was not decoded
+  RESTDECODED* decoded(const char* s) {
+    for (int i = 0;i < this->_decodedsz;++i) {
+      if (this->_decoded[i].str == s)
+        return &this->_decoded[i];
+    }
+    
+    return NULL;
+  }
+  
+  // Decode value in place once, bytes behind decoded length are left as they are
+  // Other values and views given before keep their place
+  int decode(char* s, int n, bool form) {
+    RESTDECODED* d;
+    
+    if (this->_decodedsz >= RESTFUL_DECODED_VALUES)
+      return n;
+    
+    d = &this->_decoded[this->_decodedsz++];
+    d->str = s;
+    d->len = n;
+    d->decsz = _urldecode(s, n, form);
+    return d->decsz;
+  }
+  
+  RESTVIEW findquery(const char* key, bool progmem, bool decode) {
+    RESTVIEW v = { NULL, 0 };
+    int keysz = (progmem) ? (strlen_P(key)) : (strlen(key));
     int i = 0;
-    int j = 0;
-    String value;
     
-    do {
-      if (this->_failed)
-        break;
+    if (this->_failed || this->_query == NULL)
+      return v;
+    
+    while (true) {
+      int pcnt = _struntil(&this->_query[i], '&');
+      int kcnt = min(_struntil(&this->_query[i], '='), pcnt);
+      RESTDECODED* d = (kcnt < pcnt) ? (this->decoded(&this->_query[i + kcnt + 1])) : (NULL);
       
-      int fcnt = _struntil(&this->_url_format[i], '/');
-      int ucnt = _struntil(&this->_url[j], '/');
+      // Decoded value may hold '&', so it spans its encoded length
+      if (d != NULL)
+        pcnt = kcnt + 1 + d->len;
       
-      if(this->_url_format[i] == ':') {
-        if(_strcmp(&this->_url_format[i + 1], key.c_str(), '/')) {
-          value = String();
-          value.reserve(ucnt);
-          
-          for(int k = j;k < j + ucnt;++k)
-            value += this->_url[k];
-          break;
-        }
+      if (kcnt == keysz && !((progmem) ?
+          (strncmp_P(&this->_query[i], key, keysz)) : (strncmp(&this->_query[i], key, keysz)))) {
+        v.str = &this->_query[i + kcnt + ((kcnt < pcnt) ? (1) : (0))];
+        v.len = (kcnt < pcnt) ? (pcnt - kcnt - 1) : (0);
+        
+        if (d != NULL)
+          v.len = d->decsz;
+        else if (decode)
+          v.len = this->decode(v.str, v.len, true);
+        return v;
       }
       
-      i += fcnt;
-      j += ucnt;
-    } while(this->_url_format[i++] != '\0' && this->_url[j++] != '\0');
-    
-    return value;
+      i += pcnt;
+      if (this->_query[i++] == '\0')
+        return v;
+    }
   }
   
-  String parameter(const __FlashStringHelper* key) {
+  RESTVIEW findparam(const char* key, bool progmem, bool decode) {
+    RESTVIEW v = { NULL, 0 };
+    int keysz = (progmem) ? (strlen_P(key)) : (strlen(key));
     int i = 0;
     int j = 0;
-    String value;
     
-    do {
-      if (this->_failed)
-        break;
-      
-      int fcnt = _struntil(&this->_url_format[i], '/');
-      int ucnt = _struntil(&this->_url[j], '/');
+    if (this->_failed || this->_url_format == NULL)
+      return v;
+    
+    while (true) {
+      int fcnt = (this->_url_format_P) ?
+        (_struntil_P((const __FlashStringHelper*)&this->_url_format[i], '/')) : (_struntil(&this->_url_format[i], '/'));
+      RESTDECODED* d = this->decoded(&this->_url[j]);
+      int ucnt = (d != NULL) ? ((int)d->len) : (_struntil(&this->_url[j], '/'));
       
-      if(this->_url_format[i] == ':') {
-        if(_strcmp_P(&this->_url_format[i + 1], key, '/')) {
-          value = String();
-          value.reserve(ucnt);
-          
-          for(int k = j;k < j + ucnt;++k)
-            value += this->_url[k];
-          break;
-        }
+      if (this->formatat(i) == ':' && fcnt - 1 == keysz && this->paramat(i + 1, key, keysz, progmem)) {
+        v.str = &this->_url[j];
+        v.len = ucnt;
+        
+        if (d != NULL)
+          v.len = d->decsz;
+        else if (decode)
+          v.len = this->decode(v.str, v.len, false);
+        return v;
       }
       
       i += fcnt;
       j += ucnt;
-    } while(this->_url_format[i++] != '\0' && this->_url[j++] != '\0');
-    
-    return value;
+      
+      if (this->formatat(i++) == '\0' || this->_url[j++] == '\0')
+        return v;
+    }
   }
-};
-
-
-/*
- * Response
- * 
- * 
- */
-class Response {
-friend class RESTful;
-private:
-  const __FlashStringHelper* _status;
-  const __FlashStringHelper* _constbody;
-  String _body;
-  bool _use_constbody;
-  Header* _hdr;
   
-private:
-  Response(const Header* ohdr) {
-    this->_status = NULL;
-    this->_constbody = NULL;
-    this->_use_constbody = false;
-    this->_hdr = ohdr;
+public:
+  // Getting specific URL query value
+  String query(const String& key) {
+    return tostring(this->findquery(key.c_str(), false, false));
   }
   
-public:
-  __FlashStringHelper* status() const {
-    return this->_status;
+  String query(const __FlashStringHelper* key) {
+    return tostring(this->findquery((const char*)key, true, false));
   }
   
-  void status(const __FlashStringHelper* status) {
-    if (status != NULL)
-      this->_status = status;
+  // Getting specific URL parameter value
+  String parameter(const String& key) {
+    return tostring(this->findparam(key.c_str(), false, false));
   }
   
-  __FlashStringHelper* constbody() const {
-    return this->_constbody;
+  String parameter(const __FlashStringHelper* key) {
+    return tostring(this->findparam((const char*)key, true, false));
   }
   
-  void constbody(const __FlashStringHelper* constbody) {
-    if (constbody != NULL)
-      this->_constbody = constbody;
+  // Getting value view into request buffer without allocation
+  // Percent-encoding is decoded in place when decode is true, at most once for each value
+  // Value once decoded is given decoded by later lookups too
+  RESTVIEW query_view(const char* key, bool decode = false) {
+    return this->findquery(key, false, decode);
   }
   
-  String& body() {
-    return this->_body;
+  RESTVIEW query_view(const __FlashStringHelper* key, bool decode = false) {
+    return this->findquery((const char*)key, true, decode);
   }
   
-  void body(const String& body) {
-    this->_body = body;
+  RESTVIEW parameter_view(const char* key, bool decode = false) {
+    return this->findparam(key, false, decode);
   }
   
-  bool use_constbody() const {
-    return this->_use_constbody;
+  RESTVIEW parameter_view(const __FlashStringHelper* key, bool decode = false) {
+    return this->findparam((const char*)key, true, decode);
   }
   
-  void use_constbody(bool use_constbody) {
-    this->_use_constbody = use_constbody;
+  // Getting typed value, def is returned if value is missing or invalid
+  int query_int(const char* key, int def) {
+    RESTVIEW v = this->query_view(key);
+    return (int)_strtol(v.str, v.len, def);
   }
   
-  Header* header() {
-    return this->_hdr;
+  int query_int(const __FlashStringHelper* key, int def) {
+    RESTVIEW v = this->query_view(key);
+    return (int)_strtol(v.str, v.len, def);
+  }
+  
+  long query_long(const char* key, long def) {
+    RESTVIEW v = this->query_view(key);
+    return _strtol(v.str, v.len, def);
+  }
+  
+  long query_long(const __FlashStringHelper* key, long def) {
+    RESTVIEW v = this->query_view(key);
+    return _strtol(v.str, v.len, def);
+  }
+  
+  float query_float(const char* key, float def) {
+    RESTVIEW v = this->query_view(key);
+    return _strtof(v.str, v.len, def);
+  }
+  
+  float query_float(const __FlashStringHelper* key, float def) {
+    RESTVIEW v = this->query_view(key);
+    return _strtof(v.str, v.len, def);
+  }
+  
+  int parameter_int(const char* key, int def) {
+    RESTVIEW v = this->parameter_view(key);
+    return (int)_strtol(v.str, v.len, def);
+  }
+  
+  int parameter_int(const __FlashStringHelper* key, int def) {
+    RESTVIEW v = this->parameter_view(key);
+    return (int)_strtol(v.str, v.len, def);
+  }
+  
+  long parameter_long(const char* key, long def) {
+    RESTVIEW v = this->parameter_view(key);
+    return _strtol(v.str, v.len, def);
+  }
+  
+  long parameter_long(const __FlashStringHelper* key, long def) {
+    RESTVIEW v = this->parameter_view(key);
+    return _strtol(v.str, v.len, def);
+  }
+  
+  float parameter_float(const char* key, float def) {
+    RESTVIEW v = this->parameter_view(key);
+    return _strtof(v.str, v.len, def);
+  }
+  
+  float parameter_float(const __FlashStringHelper* key, float def) {
+    RESTVIEW v = this->parameter_view(key);
+    return _strtof(v.str, v.len, def);
+  }
+  
+  int header_int(const char* key, int def) {
+    RESTVIEW v = this->_hdr->get_view(key);
+    return (int)_strtol(v.str, v.len, def);
+  }
+  
+  int header_int(const __FlashStringHelper* key, int def) {
+    RESTVIEW v = this->_hdr->get_view(key);
+    return (int)_strtol(v.str, v.len, def);
+  }
+  
+  long header_long(const char* key, long def) {
+    RESTVIEW v = this->_hdr->get_view(key);
+    return _strtol(v.str, v.len, def);
+  }
+  
+  long header_long(const __FlashStringHelper* key, long def) {
+    RESTVIEW v = this->_hdr->get_view(key);
+    return _strtol(v.str, v.len, def);
+  }
+  
+  float header_float(const char* key, float def) {
+    RESTVIEW v = this->_hdr->get_view(key);
+    return _strtof(v.str, v.len, def);
+  }
+  
+  float header_float(const __FlashStringHelper* key, float def) {
+    RESTVIEW v = this->_hdr->get_view(key);
+    return _strtof(v.str, v.len, def);
   }
 };
 
 
-typedef void (*RESTCALLBACK)(Request*, Response*, EthernetClient*);
-typedef struct _RESTHANDLER_ {
-  const char* method;
-  const char* url;
-  RESTCALLBACK request_callback;
-} RESTHANDLER;
+/*
+ * Writer
+ * 
+ * Builds response body in fixed area of RESTful buffer without heap allocation.
+ * Response becomes 500 if body does not fit in the area.
+ */
+class Writer : public Print {
+friend class RESTful;
+private:
+  char* _buf;
+  int _bufsz;
+  int _pos;
+  bool _overflow;
+  
+private:
+  Writer(char* buf, int bufsz) {
+    this->_buf = buf;
+    this->_bufsz = bufsz;
+    this->_pos = 0;
+    this->_overflow = false;
+  }
+  
+public:
+  virtual size_t write(uint8_t c) {
+    return this->write(&c, 1);
+  }
+  
+  virtual size_t write(const uint8_t* s, size_t n) {
+    if (this->_overflow || (long)n > (long)(this->_bufsz - this->_pos)) {
+      this->_overflow = true;
+      return 0;
+    }
+    
+    memcpy(&this->_buf[this->_pos], s, n);
+    this->_pos += n;
+    return n;
+  }
+  
+  using Print::write;
+  
+  // Append string escaped to be placed between quotes of JSON string
+  size_t print_escaped(const char* s, int n) {
+    size_t m = 0;
+    
+    for (int i = 0;i < n;++i) {
+      unsigned char c = (unsigned char)s[i];
+      
+      if (c == '"' || c == '\\') {
+        m += this->print('\\');
+        m += this->print((char)c);
+      } else if (c == '\n') {
+        m += this->print(F("\\n"));
+      } else if (c == '\r') {
+        m += this->print(F("\\r"));
+      } else if (c == '\t') {
+        m += this->print(F("\\t"));
+      } else if (c < 0x20) {
+        m += this->print(F("\\u00"));
+        m += this->print("0123456789abcdef"[c >> 4]);
+        m += this->print("0123456789abcdef"[c & 0x0F]);
+      } else {
+        m += this->write(c);
+      }
+    }
+    
+    return m;
+  }
+  
+  size_t print_escaped(const char* s) {
+    return this->print_escaped(s, strlen(s));
+  }
+  
+  size_t print_escaped(const RESTVIEW& v) {
+    return this->print_escaped(v.str, v.len);
+  }
+  
+  const char* str() const {
+    return this->_buf;
+  }
+  
+  int length() const {
+    return this->_pos;
+  }
+  
+  int capacity() const {
+    return this->_bufsz;
+  }
+  
+  bool overflow() const {
+    return this->_overflow;
+  }
+  
+  void clear() {
+    this->_pos = 0;
+    this->_overflow = false;
+  }
+};
 
 
 /*
- * RESTful Framework for Arduino
+ * Response
  * 
  * 
  */
-class RESTful {
+class Response {
+friend class RESTful;
+friend struct _RESTBATCH_;
+private:
+  const __FlashStringHelper* _status;
+  const __FlashStringHelper* _constbody;
+  String _body;
+  bool _use_constbody;
+  RESTSTREAMCALLBACK _stream;
+  void* _context;
+  Writer* _writer;
+  Header* _hdr;
+  unsigned long _timeout;
+  unsigned char _state;
+  bool _deferred;
+  
+private:
+  Response(Header* ohdr) {
+    this->_status = NULL;
+    this->_constbody = NULL;
+    this->_use_constbody = false;
+    this->_stream = NULL;
+    this->_context = NULL;
+    this->_writer = NULL;
+    this->_hdr = ohdr;
+    this->_timeout = 0;
+    this->_state = 0;
+    this->_deferred = false;
+  }
+  
+public:
+  const __FlashStringHelper* status() const {
+    return this->_status;
+  }
+  
+  void status(const __FlashStringHelper* status) {
+    if (status != NULL)
+      this->_status = status;
+  }
+  
+  const __FlashStringHelper* constbody() const {
+    return this->_constbody;
+  }
+  
+  void constbody(const __FlashStringHelper* constbody) {
+    if (constbody != NULL)
+      this->_constbody = constbody;
+  }
+  
+  String& body() {
+    return this->_body;
+  }
+  
+  void body(const String& body) {
+    this->_body = body;
+  }
+  
+  bool use_constbody() const {
+    return this->_use_constbody;
+  }
+  
+  void use_constbody(bool use_constbody) {
+    this->_use_constbody = use_constbody;
+  }
+  
+  // Body is produced block by block after handler returns
+  // Producer fills given buffer and returns its length, 0 ends the body
+  // Given buffer is taken from request buffer, so producer must not use views of Request,
+  // values it needs are copied into context by handler
+  void stream(RESTSTREAMCALLBACK producer, void* context) {
+    this->_stream = producer;
+    this->_context = context;
+  }
+  
+  bool use_stream() const {
+    return (this->_stream != NULL);
+  }
+  
+  // Handler is called again later with state, response of the last call is sent
+  // Response becomes 504 if handler does not complete within timeout from first call
+  void defer(unsigned long timeout, unsigned char state) {
+    this->_timeout = timeout;
+    this->_state = state;
+    this->_deferred = true;
+  }
+  
+  bool deferred() const {
+    return this->_deferred;
+  }
+  
+  // Body written here is used instead of String body
+  Writer* writer() {
+    return this->_writer;
+  }
+  
+  bool use_writer() const {
+    return (this->_writer != NULL && (this->_writer->length() > 0 || this->_writer->overflow()));
+  }
+  
+  Header* header() {
+    return this->_hdr;
+  }
+};
+
+
+/*
+ * Transmitter
+ * 
+ * Collects response into fixed buffer and writes it to client by blocks.
+ */
+class Transmitter {
+friend class RESTful;
 private:
+  RESTCLIENT* _client;
   char* _buf;
-  char* _rbuf;
-  RESTHANDLER* _hdlr;
   int _bufsz;
-  int _rbufsz;
-  int _hdlrsz;
+  int _pos;
+  unsigned long _sent;
+  bool _failed;
+  
+private:
+  Transmitter(RESTCLIENT* client, char* buf, int bufsz) {
+    this->_client = client;
+    this->_buf = buf;
+    this->_bufsz = bufsz;
+    this->_pos = 0;
+    this->_sent = 0;
+    this->_failed = false;
+  }
+  
+private:
+  // Nothing more is written once client takes nothing, peer is gone or cut off
+  void send(const char* s, int n) {
+    if (this->_failed || n <= 0)
+      return;
+    
+    int m = this->_client->write((const uint8_t*)s, n);
+    this->_failed = (m <= 0);
+    this->_sent += max(m, 0);
+  }
+  
+  void flush() {
+    if (this->_pos > 0)
+      this->send(this->_buf, this->_pos);
+    this->_pos = 0;
+  }
+  
+  void write(const char* s, int n) {
+    // Large block is written directly when nothing is pending
+    if (this->_pos == 0 && n >= this->_bufsz) {
+      if (n > 0)
+        this->send(s, n);
+      return;
+    }
+    
+    while (n > 0) {
+      int m = min(n, this->_bufsz - this->_pos);
+      
+      memcpy(&this->_buf[this->_pos], s, m);
+      this->_pos += m;
+      s += m;
+      n -= m;
+      
+      if (this->_pos == this->_bufsz)
+        this->flush();
+    }
+  }
+  
+  void print(const char* s) {
+    this->write(s, strlen(s));
+  }
+  
+  void print(const String& s) {
+    this->write(s.c_str(), s.length());
+  }
+  
+  void print(unsigned long v) {
+    char num[21];
+    int i = sizeof(num);
+    
+    do {
+      num[--i] = '0' + (v % 10);
+      v /= 10;
+    } while (v != 0);
+    
+    this->write(&num[i], sizeof(num) - i);
+  }
+  
+  // Send body from producer, each block becomes one chunk when chunked
+  void stream(RESTSTREAMCALLBACK producer, void* context, bool chunked) {
+    const int hsz = 10;
+    char* data = (chunked) ? (this->_buf + hsz) : (this->_buf);
+    int room = (chunked) ? (this->_bufsz - hsz - 2) : (this->_bufsz);
+    
+    this->flush();
+    
+    while (room > 0 && !this->_failed) {
+      int n = producer(data, room, context);
+      if (n <= 0)
+        break;
+      
+      if (!chunked) {
+        this->send(data, n);
+        continue;
+      }
+      
+      // Chunk size is placed right in front of data
+      int i = hsz - 2;
+      this->_buf[hsz - 2] = '\r';
+      this->_buf[hsz - 1] = '\n';
+      for (int v = n;v != 0;v >>= 4)
+        this->_buf[--i] = "0123456789abcdef"[v & 0x0F];
+      data[n] = '\r';
+      data[n + 1] = '\n';
+      this->send(&this->_buf[i], (hsz - i) + n + 2);
+    }
+    
+    if (chunked)
+      this->send("0\r\n\r\n", 5);
+  }
+  
+  void print(const __FlashStringHelper* s) {
+    const char PROGMEM* ps = (const char PROGMEM*)s;
+    this->write_P(ps, strlen_P(ps));
+  }
+  
+  // Flash memory is copied into buffer by blocks, each full block is written once
+  void write_P(const char PROGMEM* ps, long n) {
+    if (this->_bufsz <= 0)
+      return;
+    
+    while (n > 0) {
+      int m = (int)min(n, (long)(this->_bufsz - this->_pos));
+      
+      memcpy_P(&this->_buf[this->_pos], ps, m);
+      this->_pos += m;
+      ps += m;
+      n -= m;
+      
+      if (this->_pos == this->_bufsz)
+        this->flush();
+    }
+  }
+};
+
+
+/*
+ * WebSocket
+ * 
+ * Frames on connection upgraded by handler flagged RESTFUL_WEBSOCKET.
+ * Handler attaches client, RESTful sends handshake and leaves connection open.
+ * Ping and close frames are answered while receiving.
+ */
+#define RESTFUL_WS_CONTINUATION                   0x00
+#define RESTFUL_WS_TEXT                           0x01
+#define RESTFUL_WS_BINARY                         0x02
+#define RESTFUL_WS_CLOSE                          0x08
+#define RESTFUL_WS_PING                           0x09
+#define RESTFUL_WS_PONG                           0x0A
+
+class WebSocket {
+private:
+  RESTCLIENT _client;
+  bool _attached;
+  unsigned char _hdr[14];
+  int _hdrsz;
+  unsigned long _remaining;
+  int _maskpos;
+  unsigned char _opcode;
+  
+private:
+  // Frame header is complete when length and mask are received
+  int headersize() const {
+    int n = 2;
+    
+    if (this->_hdrsz < 2)
+      return n;
+    if ((this->_hdr[1] & 0x7F) == 126)
+      n += 2;
+    else if ((this->_hdr[1] & 0x7F) == 127)
+      n += 8;
+    
+    return n + ((this->_hdr[1] & 0x80) ? (4) : (0));
+  }
+  
+  unsigned long payloadsize() const {
+    unsigned long n = this->_hdr[1] & 0x7F;
+    
+    if (n == 126)
+      n = ((unsigned long)this->_hdr[2] << 8) | this->_hdr[3];
+    else if (n == 127) {
+      n = 0;
+      for (int i = 6;i < 10;++i)
+        n = (n << 8) | this->_hdr[i];
+    }
+    
+    return n;
+  }
+  
+  void unmask(char* buf, int n) {
+    const unsigned char* mask = &this->_hdr[this->headersize() - 4];
+    
+    for (int i = 0;i < n;++i)
+      buf[i] ^= mask[(this->_maskpos++) & 3];
+  }
+  
+  // Control frame is read at once, its payload is at most 125 bytes
+  int control() {
+    char buf[125];
+    int n = (int)this->_remaining;
+    
+    if (this->_client.available() < n)
+      return 0;
+    if (n > 0 && this->_client.read((uint8_t*)buf, n) != n)
+      return this->fail();
+    this->unmask(buf, n);
+    this->_hdrsz = 0;
+    this->_remaining = 0;
+    
+    if (this->_opcode == RESTFUL_WS_PING) {
+      this->send(buf, n, RESTFUL_WS_PONG);
+    } else if (this->_opcode == RESTFUL_WS_CLOSE) {
+      this->send(buf, min(n, 2), RESTFUL_WS_CLOSE);
+      this->_client.stop();
+      this->_attached = false;
+      return -1;
+    }
+    
+    return 0;
+  }
+  
+  int fail() {
+    this->close(1002);
+    return -1;
+  }
+  
+public:
+  WebSocket() {
+    this->_attached = false;
+    this->_hdrsz = 0;
+    this->_remaining = 0;
+    this->_maskpos = 0;
+    this->_opcode = 0;
+  }
+  
+  // Called by handler, connection is upgraded when handler leaves status 101
+  void attach(RESTCLIENT* client) {
+    this->_client = *client;
+    this->_attached = true;
+    this->_hdrsz = 0;
+    this->_remaining = 0;
+    this->_opcode = 0;
+  }
+  
+  bool connected() {
+    return this->_attached && this->_client.connected();
+  }
+  
+  // Server frames are not masked, small frame is written at once with its header
+  // Length above 65535 takes 8 bytes, high ones are zero since n is int
+  bool send(const char* s, int n, unsigned char opcode) {
+    char frame[10 + 64];
+    int m = 2;
+    
+    if (!this->_attached || n < 0)
+      return false;
+    
+    frame[0] = (char)(0x80 | opcode);
+    if (n < 126) {
+      frame[1] = (char)n;
+    } else if (n <= 0xFFFF) {
+      frame[1] = 126;
+      frame[2] = (char)(n >> 8);
+      frame[3] = (char)(n & 0xFF);
+      m = 4;
+    } else {
+      frame[1] = 127;
+      for (int i = 2;i < 10;++i)
+        frame[i] = (char)((i < 6) ? (0) : (((unsigned long)n >> (8 * (9 - i))) & 0xFF));
+      m = 10;
+    }
+    
+    if (n <= 64) {
+      memcpy(&frame[m], s, n);
+      return (this->_client.write((const uint8_t*)frame, m + n) == (size_t)(m + n));
+    }
+    
+    return (this->_client.write((const uint8_t*)frame, m) == (size_t)m) &&
+      (this->_client.write((const uint8_t*)s, n) == (size_t)n);
+  }
+  
+  bool send_text(const char* s) {
+    return this->send(s, strlen(s), RESTFUL_WS_TEXT);
+  }
+  
+  bool send_binary(const uint8_t* s, int n) {
+    return this->send((const char*)s, n, RESTFUL_WS_BINARY);
+  }
+  
+  bool ping() {
+    return this->send(NULL, 0, RESTFUL_WS_PING);
+  }
+  
+  void close(unsigned short code = 1000) {
+    char payload[2] = { (char)(code >> 8), (char)(code & 0xFF) };
+    
+    this->send(payload, 2, RESTFUL_WS_CLOSE);
+    this->_client.stop();
+    this->_attached = false;
+  }
+  
+  // Read available payload of data frames without blocking
+  // Returns bytes read, 0 if nothing is available and -1 when connection is closed
+  // Opcode of frame is stored if given, continuation frames have RESTFUL_WS_CONTINUATION
+  int receive(char* buf, int n, unsigned char* opcode = NULL) {
+    if (!this->connected())
+      return -1;
+    
+    // Frame header is received byte by byte, control frames are handled on the way
+    while (this->_hdrsz < this->headersize() || this->_remaining == 0 || this->_opcode >= RESTFUL_WS_CLOSE) {
+      if (this->_hdrsz == this->headersize()) {
+        if (this->_opcode < RESTFUL_WS_CLOSE) {
+          // Empty data frame
+          this->_hdrsz = 0;
+          continue;
+        }
+        if (this->control() < 0)
+          return -1;
+        if (this->_hdrsz != 0)
+          return 0;
+        continue;
+      }
+      
+      if (this->_client.available() <= 0)
+        return 0;
+      this->_hdr[this->_hdrsz++] = (unsigned char)this->_client.read();
+      
+      if (this->_hdrsz == this->headersize()) {
+        // Client frames must be masked
+        if (!(this->_hdr[1] & 0x80))
+          return this->fail();
+        this->_opcode = this->_hdr[0] & 0x0F;
+        this->_remaining = this->payloadsize();
+        this->_maskpos = 0;
+        if (this->_opcode >= RESTFUL_WS_CLOSE && this->_remaining > 125)
+          return this->fail();
+      }
+    }
+    
+    int m = min((long)n, (long)min(this->_remaining, (unsigned long)this->_client.available()));
+    if (m <= 0)
+      return 0;
+    
+    m = this->_client.read((uint8_t*)buf, m);
+    if (m <= 0)
+      return 0;
+    
+    this->unmask(buf, m);
+    this->_remaining -= m;
+    if (this->_remaining == 0)
+      this->_hdrsz = 0;
+    if (opcode != NULL)
+      *opcode = this->_opcode;
+    return m;
+  }
+};
+
+
+// Handler flags
+#define RESTFUL_CACHEABLE                         0x01
+#define RESTFUL_WEBSOCKET                         0x02
+#define RESTFUL_EVENTSTREAM                       0x04
+
+
+typedef void (*RESTCALLBACK)(Request*, Response*, RESTCLIENT*);
+
+/*
+ * Handler
+ * 
+ * Flags are optional, { "GET", "/users/:id", callback } is initialized by constructor with no flags.
+ */
+typedef struct _RESTHANDLER_ {
+  const char* method;
+  const char* url;
+  RESTCALLBACK request_callback;
+  unsigned char flags;
+  
+  constexpr _RESTHANDLER_() : method(NULL), url(NULL), request_callback(NULL), flags(0) {}
+  constexpr _RESTHANDLER_(const char* m, const char* u, RESTCALLBACK cb, unsigned char f = 0) :
+    method(m), url(u), request_callback(cb), flags(f) {}
+} RESTHANDLER;
+
+
+/*
+ * Route
+ * 
+ * Handler declared in PROGMEM table, URL pattern is a string of its own in flash.
+ * Literal inside initializer would be placed in SRAM, so pattern is declared with PROGMEM.
+ * const char users_id[] PROGMEM = "/users/:id";
+ * const RESTROUTE routes[] PROGMEM = { { REST_GET, users_id, callback }, };
+ */
+typedef struct _RESTROUTE_ {
+  unsigned char method;
+  const char PROGMEM* url;
+  RESTCALLBACK request_callback;
+  unsigned char flags;
+  
+  // Constant initialization keeps table in flash
+  constexpr _RESTROUTE_() : method(REST_UNKNOWN), url(NULL), request_callback(NULL), flags(0) {}
+  constexpr _RESTROUTE_(unsigned char m, const char PROGMEM* u, RESTCALLBACK cb, unsigned char f = 0) :
+    method(m), url(u), request_callback(cb), flags(f) {}
+} RESTROUTE;
+
+
+#ifndef RESTFUL_ROUTE_URL_SIZE
+#define RESTFUL_ROUTE_URL_SIZE                    32
+#endif
+#ifndef RESTFUL_ASSET_TYPE_SIZE
+#define RESTFUL_ASSET_TYPE_SIZE                   32
+#endif
+#ifndef RESTFUL_ASSET_CACHE_CONTROL
+#define RESTFUL_ASSET_CACHE_CONTROL               "public, max-age=86400"
+#endif
+
+
+/*
+ * Static asset
+ * 
+ * Content placed in PROGMEM served for GET of exact URL, gzip variant is optional.
+ * const RESTASSET assets[] PROGMEM = { { "/index.html", "text/html", index_html, sizeof(index_html) - 1, NULL, 0 }, };
+ */
+typedef struct _RESTASSET_ {
+  char url[RESTFUL_ROUTE_URL_SIZE];
+  char content_type[RESTFUL_ASSET_TYPE_SIZE];
+  const char PROGMEM* data;
+  unsigned long length;
+  const char PROGMEM* gzdata;
+  unsigned long gzlength;
+} RESTASSET;
+
+
+/*
+ * Cache entry
+ * 
+ * Entries are laid out back to back in cache area, each one followed by
+ * key (URL and query), header fields and body of 200 response.
+ * Entry of other cache version than current one is never served.
+ */
+typedef struct _RESTCACHEENTRY_ {
+  unsigned long etag;
+  unsigned long version;
+  unsigned short keysz;
+  unsigned short hdrsz;
+  unsigned short bodysz;
+} RESTCACHEENTRY;
+
+
+/*
+ * Route index node
+ * 
+ * Segment trie built once from RESTHANDLER array or RESTROUTE table.
+ * Children of the root are methods, children of a method are URL segments.
+ * Built from RESTROUTE table, segments point into flash and method nodes keep RESTMETHOD in segsz.
+ * Each node has literal children and at most one ':param' wildcard child.
+ * Required nodes: 1 (root) + distinct methods + distinct URL segments.
+ */
+typedef struct _RESTNODE_ {
+  const char* seg;
+  unsigned char segsz;
+  short child;
+  short sibling;
+  short param;
+  short hdlr;
+} RESTNODE;
+
+
+#ifdef RESTFUL_METRICS
+#ifndef RESTFUL_METRICS_ROUTES
+#define RESTFUL_METRICS_ROUTES                    16
+#endif
+#ifndef RESTFUL_METRICS_URL
+#define RESTFUL_METRICS_URL                       "/metrics"
+#endif
+#define RESTFUL_METRICS_BUCKETS                   12
+
+
+/*
+ * Metrics
+ * 
+ * Fixed-size counters, histogram bucket i counts latencies up to 2^i ms and last one the rest.
+ */
+typedef struct _RESTHISTOGRAM_ {
+  unsigned long bucket[RESTFUL_METRICS_BUCKETS];
+  unsigned long sum;
+  unsigned long count;
+} RESTHISTOGRAM;
+
+typedef struct _RESTROUTEMETRICS_ {
+  unsigned long hits;
+  unsigned long client_errors;
+  unsigned long server_errors;
+  unsigned long bytes_in;
+  unsigned long bytes_out;
+} RESTROUTEMETRICS;
+
+typedef struct _RESTMETRICS_ {
+  RESTROUTEMETRICS route[RESTFUL_METRICS_ROUTES];
+  RESTHISTOGRAM receive;
+  RESTHISTOGRAM dispatch;
+  RESTHISTOGRAM send;
+  unsigned long timeouts;
+  unsigned long parse_failures;
+  unsigned long overflows;
+  unsigned long not_found;
+  unsigned long not_allowed;
+  unsigned long not_implemented;
+} RESTMETRICS;
+#endif
+
+
+/*
+ * Deferred request
+ * 
+ * Request of deferred handler parked while other connections are served.
+ */
+typedef struct _RESTDEFERRED_ {
+  Header ihdr;
+  Request req;
+  RESTROUTE route;
+  RESTCALLBACK callback;
+  int ri;
+  unsigned long ts;
+  unsigned long timeout;
+  bool persist;
+  bool used;
+  
+  _RESTDEFERRED_() : req(&ihdr) {
+    this->used = false;
+  }
+} RESTDEFERRED;
+
+
+#ifdef RESTFUL_BATCH
+#ifndef RESTFUL_BATCH_URL
+#define RESTFUL_BATCH_URL                         "/_batch"
+#endif
+#ifndef RESTFUL_BATCH_LINE_SIZE
+#define RESTFUL_BATCH_LINE_SIZE                   64
+#endif
+
+class RESTful;
+
+
+/*
+ * Batch
+ * 
+ * Calls listed in body of batch request, each one runs when previous result is sent.
+ * Body of pending result is sent from where handler left it.
+ */
+typedef struct _RESTBATCH_ {
+  RESTful* rest;
+  Request* batch;
+  RESTCLIENT* client;
+  char* next;
+  char* end;
+  char line[RESTFUL_BATCH_LINE_SIZE];
+  Header ohdr;
+  Response res;
+  char head[24];
+  int headsz;
+  const char* body;
+  long bodysz;
+  bool flash;
+  long pos;
+  bool pending;
+  
+  _RESTBATCH_() : res(&ohdr) {
+    this->next = NULL;
+    this->end = NULL;
+    this->pending = false;
+  }
+} RESTBATCH;
+#endif
+
+
+/*
+ * Connection
+ * 
+ * Request reception state kept between RESTful::poll calls.
+ * Array of connections can be given to RESTful to serve clients concurrently.
+ */
+typedef struct _RESTCONNECTION_ {
+  RESTCLIENT client;
+  bool used;
+  char* buf;
+  int bufsz;
+  int recvsz;
+  int scansz;
+  int line;
+  bool isblank;
+  bool skip;
+  bool active;
+  bool detached;
+  RESTDEFERRED* deferred;
+  int nextpos;
+  int nextsz;
+  long skipsz;
+  int nreq;
+  unsigned long ts;
+  unsigned long begin;
+} RESTCONNECTION;
+
+
+/*
+ * Subscriber
+ * 
+ * Client of route flagged RESTFUL_EVENTSTREAM kept open for RESTful::broadcast.
+ * Event stream header is written over request buffer, so views of Request end with handler.
+ * Anything needed later to pick events for the client is copied by handler.
+ */
+typedef struct _RESTSUBSCRIBER_ {
+  RESTCLIENT client;
+  bool used;
+} RESTSUBSCRIBER;
+
+
+/*
+ * RESTful Framework for Arduino
+ * 
+ * 
+ */
+class RESTful {
+private:
+  char* _buf;
+  char* _rbuf;
+  char* _wbuf;
+  RESTHANDLER* _hdlr;
+  const RESTROUTE* _routes;
+  const RESTASSET* _assets;
+  const char* const* _filter;
+  RESTNODE* _idx;
+  RESTCONNECTION _conn;
+  RESTCONNECTION* _pool;
+  RESTSUBSCRIBER* _subs;
+  RESTDEFERRED* _defer;
+  char* _evbuf;
+  int _poolsz;
+  int _rr;
+  char* _cache;
+  int _cachesz;
+  int _cachepos;
+  unsigned long _cachever;
+#ifdef RESTFUL_METRICS
+  RESTMETRICS _metrics;
+  int _mline;
+#endif
+  int _bufsz;
+  int _rbufsz;
+  int _wbufsz;
+  int _hdlrsz;
+  int _routesz;
+  int _assetsz;
+  int _filtersz;
+  int _subsz;
+  int _defersz;
+  int _evbufsz;
+  int _evtimeout;
+  
+private:
+  int _recvtimeout;
+  int _bodytimeout;
+  int _katimeout;
+  int _kamax;
+  long _bodymax;
+  
+private:
+  static void buildreq(char* buf, int bufsz, char* rbuf, int rbufsz, int presz, Request* req, Response* res) {
+    int eor = _struntil(buf, '\r');
+    char* hdrstr = buf + eor + 2;
+    
+    req->_body = buf + strlen(buf) + 1;
+    req->_bodysz = presz;
+    buf[eor] = '\0';
+    res->status(HTTP_404_NOT_FOUND);
+    req->setbuf(buf);
+    req->header()->setbuf(hdrstr, bufsz - (eor + 2));
+    req->header()->index(req->_fields, RESTFUL_HEADER_FIELDS);
+    req->_length = req->header_long(F("Content-Length"), -1);
+    req->_remaining = (req->_length > 0) ? (req->_length) : (0);
+    
+    if (res->header() && rbufsz) {
+      rbuf[0] = '\0';
+      res->header()->setbuf(rbuf, rbufsz);
+    }
+  }
+  
+  static void initconn(RESTCONNECTION* conn) {
+    conn->nextsz = 0;
+    conn->skipsz = 0;
+    nextconn(conn);
+  }
+  
+  // Pipelined bytes are moved to buffer start and scanned as next request
+  static void nextconn(RESTCONNECTION* conn) {
+    int n = conn->nextsz;
+    
+    if (n > 0 && conn->nextpos > 0)
+      memmove(conn->buf, conn->buf + conn->nextpos, n);
+    memset(conn->buf + n, 0x00, conn->bufsz - n);
+    conn->nextsz = 0;
+    conn->recvsz = n;
+    conn->scansz = 0;
+    conn->line = -1;
+    conn->isblank = true;
+    conn->skip = false;
+    conn->ts = millis();
+    conn->begin = conn->ts;
+  }
+  
+  // Header fields used by RESTful itself are never dropped
+  static bool essential(const char* key, int keysz) {
+    return (keysz == 14 && !strncasecmp_P(key, PSTR("Content-Length"), 14)) ||
+      (keysz == 17 && !strncasecmp_P(key, PSTR("Transfer-Encoding"), 17)) ||
+      (keysz == 10 && !strncasecmp_P(key, PSTR("Connection"), 10)) ||
+      (keysz == 6 && !strncasecmp_P(key, PSTR("Expect"), 6)) ||
+      (keysz == 13 && !strncasecmp_P(key, PSTR("If-None-Match"), 13)) ||
+      (keysz == 15 && !strncasecmp_P(key, PSTR("Accept-Encoding"), 15)) ||
+      (keysz == 7 && !strncasecmp_P(key, PSTR("Upgrade"), 7)) ||
+      (keysz == 17 && !strncasecmp_P(key, PSTR("Sec-WebSocket-Key"), 17)) ||
+      (keysz == 21 && !strncasecmp_P(key, PSTR("Sec-WebSocket-Version"), 21));
+  }
+  
+  bool kept(const char* key, int keysz) const {
+    if (this->_filter == NULL || essential(key, keysz))
+      return true;
+    
+    for (int i = 0;i < this->_filtersz;++i) {
+      if ((int)strlen(this->_filter[i]) == keysz && !strncasecmp(this->_filter[i], key, keysz))
+        return true;
+    }
+    
+    return false;
+  }
+  
+  // Returns 1 when header is complete, 0 when more bytes are needed, -1 on buffer overflow
+  // Bytes received after the blank line are kept behind header terminator
+  // Header fields not in allowlist are dropped as they are scanned and their space is reused
+  int recvsome(RESTCLIENT* client, RESTCONNECTION* conn, int* presz) {
+    char* buf = conn->buf;
+    int bufsz = conn->bufsz;
+    int n = client->available();
+    int w = conn->scansz;
+    int room = bufsz - 2 - conn->recvsz;
+    
+    // Room for response is left behind pipelined requests, header only takes it when it needs whole buffer
+    if (room > RESTFUL_TRANSMIT_MIN_SIZE)
+      room -= RESTFUL_TRANSMIT_MIN_SIZE;
+    if (n > room)
+      n = room;
+    
+    if (n > 0) {
+      n = client->read((uint8_t*)&buf[conn->recvsz], n);
+      if (n > 0) {
+        if (conn->recvsz == 0)
+          conn->begin = millis();
+        conn->recvsz += n;
+        conn->ts = millis();
+      }
+    }
+    
+    while (conn->scansz < conn->recvsz) {
+      char c = buf[conn->scansz++];
+      
+      if (conn->skip) {
+        if (c == '\n') {
+          conn->skip = false;
+          conn->isblank = true;
+          conn->line = w;
+        }
+        continue;
+      }
+      
+      buf[w++] = c;
+      if ((c == '\n') && conn->isblank) {
+        *presz = conn->recvsz - conn->scansz;
+        memmove(&buf[w + 1], &buf[conn->scansz], *presz);
+        buf[w] = '\0';
+        buf[w + 1 + *presz] = '\0';
+        conn->scansz = w;
+        conn->recvsz = w + *presz;
+        return 1;
+      }
+      
+      // Field is kept or dropped once its key is complete
+      if (c == ':' && conn->line >= 0) {
+        if (!this->kept(&buf[conn->line], w - 1 - conn->line)) {
+          w = conn->line;
+          conn->skip = true;
+        }
+        conn->line = -1;
+      } else if (c == '\n') {
+        conn->line = w;
+      }
+      
+      conn->isblank = ((c == '\n') ? (true) : ((c == '\r') ? conn->isblank : false));
+    }
+    
+    // Close the gap left by dropped fields
+    if (w < conn->scansz) {
+      memmove(&buf[w], &buf[conn->scansz], conn->recvsz - conn->scansz);
+      conn->recvsz -= conn->scansz - w;
+      conn->scansz = w;
+    }
+    
+    // Header reached room left for response, so it takes the rest of buffer now
+    if (conn->recvsz < bufsz - 2 && conn->recvsz >= bufsz - 2 - RESTFUL_TRANSMIT_MIN_SIZE && client->available() > 0)
+      return this->recvsome(client, conn, presz);
+    
+    return (conn->recvsz < bufsz - 2) ? (0) : (-1);
+  }
+  
+  // Returns 1 when header is complete, 0 on timeout or disconnection, -1 on buffer overflow
+  // Timeout is measured from first byte, so trickling client can not extend it
+  // Bytes already received are scanned before connection is checked, half-closed peer may have pipelined them
+  int recvall(RESTCLIENT* client, unsigned long interval, RESTCONNECTION* conn, int* presz) {
+    nextconn(conn);
+    
+    while (true) {
+      int r = this->recvsome(client, conn, presz);
+      if (r != 0)
+        return r;
+      if (timeover(conn->begin, interval) || !client->connected())
+        return 0;
+    }
+  }
+  
+  static bool urlmatch(const char* format, const char* url) {
+    int i = 0;
+    int j = 0;
+    
+    while(true) {
+      int fcnt = _struntil(&format[i], '/');
+      int ucnt = _struntil(&url[j], '/');
+      
+      if(!_strcmp(&format[i], &url[j], '/')) {
+        if(format[i] != ':' || ucnt <= 0)
+          return false;
+      }
+      
+      i += (fcnt);
+      j += (ucnt);
+      
+      if(format[i] == '\0' || url[j] == '\0')
+        break;
+      
+      ++i; ++j;
+    }
+    
+    return !(strlen(&format[i]) + strlen(&url[j]));
+  }
+  
+  static bool urlmatch_P(const char PROGMEM* format, const char* url) {
+    int i = 0;
+    int j = 0;
+    
+    while(true) {
+      const __FlashStringHelper* f = (const __FlashStringHelper*)&format[i];
+      int fcnt = _struntil_P(f, '/');
+      int ucnt = _struntil(&url[j], '/');
+      
+      if(!_strcmp_P(&url[j], f, '/')) {
+        if(pgm_read_byte(&format[i]) != ':' || ucnt <= 0)
+          return false;
+      }
+      
+      i += (fcnt);
+      j += (ucnt);
+      
+      if(pgm_read_byte(&format[i]) == '\0' || url[j] == '\0')
+        break;
+      
+      ++i; ++j;
+    }
+    
+    return (pgm_read_byte(&format[i]) == '\0' && url[j] == '\0');
+  }
+  
+  // Matched route is copied to SRAM to be used while handler is running
+  static int findroute(const RESTROUTE* routes, int len, RESTMETHOD method, Request* req, Response* res, RESTROUTE* route) {
+    for (int i = 0;i < len;++i) {
+      const RESTROUTE* r = &(routes[i]);
+      
+      if (pgm_read_byte(&r->method) == method && urlmatch_P((const char PROGMEM*)pgm_read_ptr(&r->url), req->url())) {
+        memcpy_P(route, r, sizeof(RESTROUTE));
+        res->status(HTTP_200_OK);
+        req->url_format(route->url, true);
+        return i;
+      }
+    }
+    
+    return -1;
+  }
+  
+  static RESTHANDLER* findhdlr(RESTHANDLER* handler, int len, const char* method, Request* req, Response* res) {
+    for (int i = 0;i < len;++i) {
+      RESTHANDLER* h = &(handler[i]);
+      
+      // First byte rejects most handlers of other methods
+      if (h->method[0] == method[0] && (!strcmp(h->method, method)) && urlmatch(h->url, req->url())) {
+        res->status(HTTP_200_OK);
+        req->url_format(h->url);
+        return h;
+      }
+    }
+    
+    return NULL;
+  }
+  
+  // Request line without line feed did not fit in buffer, otherwise header fields did not
+  static const __FlashStringHelper* overflowed(RESTCONNECTION* conn) {
+    return (memchr(conn->buf, '\n', conn->recvsz) == NULL) ?
+      (HTTP_414_REQUEST_URI_TOO_LARGE) : (HTTP_431_REQUEST_HEADER_FIELDS_TOO_LARGE);
+  }
+  
+  // Sec-WebSocket-Accept value is made while request buffer is still intact
+  // Returns 1 when it is made, 0 for no upgrade, -1 for malformed key and -2 for other version
+  static int upgrading(Request* req, char* accept) {
+    RESTVIEW upgrade = req->header()->get_view(F("Upgrade"));
+    RESTVIEW key = req->header()->get_view(F("Sec-WebSocket-Key"));
+    RESTVIEW version = req->header()->get_view(F("Sec-WebSocket-Version"));
+    char s[24 + 36 + 1];
+    unsigned char digest[20];
+    
+    if (req->method_id() != REST_GET || upgrade.len != 9 || strncasecmp_P(upgrade.str, PSTR("websocket"), 9))
+      return 0;
+    // Key is base64 of 16 bytes, which is always 24 characters
+    if (key.len != 24)
+      return -1;
+    if (version.len != 2 || strncmp(version.str, "13", 2))
+      return -2;
+    
+    memcpy(s, key.str, 24);
+    strcpy_P(&s[24], PSTR("258EAFA5-E914-47DA-95CA-C5AB0DC85B11"));
+    _sha1(s, 24 + 36, digest);
+    _base64(digest, 20, accept);
+    return 1;
+  }
+  
+  static void handshake(Transmitter* tx, Response* res, const char* accept) {
+    tx->print(res->status());
+    tx->print(F("Upgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: "));
+    tx->print(accept);
+    tx->print(HTTP_END_OF_REQUEST);
+    if (res->header() != NULL && res->header()->transmissible())
+      tx->print(res->header()->str());
+    tx->print(HTTP_END_OF_REQUEST);
+    tx->flush();
+  }
+  
+  RESTSUBSCRIBER* subscribe(RESTCLIENT& client) {
+    for (int i = 0;i < this->_subsz;++i) {
+      if (!this->_subs[i].used) {
+        this->_subs[i].client = client;
+        this->_subs[i].used = true;
+        return &this->_subs[i];
+      }
+    }
+    
+    return NULL;
+  }
+  
+  // Event stream has no length, events follow header until client leaves
+  static void eventstream(Transmitter* tx, Response* res) {
+    tx->print(res->status());
+    tx->print(F("Content-Type: text/event-stream\r\nCache-Control: no-cache\r\n"));
+    if (res->header() != NULL && res->header()->transmissible())
+      tx->print(res->header()->str());
+    tx->print(HTTP_END_OF_REQUEST);
+    tx->flush();
+  }
+  
+  static bool expects(Request* req) {
+    RESTVIEW v = req->header()->get_view(F("Expect"));
+    return (v.len == 12 && !strncasecmp_P(v.str, PSTR("100-continue"), 12));
+  }
+  
+  // Interim response is written at once, request buffer still holds body
+  static void proceed(RESTCLIENT& client) {
+    char line[32];
+    
+    strcpy_P(line, (const char PROGMEM*)HTTP_100_CONTINUE);
+    strcat_P(line, (const char PROGMEM*)HTTP_END_OF_REQUEST);
+    client.write((const uint8_t*)line, strlen(line));
+  }
+  
+  static bool keepalive(Request* req) {
+    RESTVIEW conn = req->header()->get_view(F("Connection"));
+    
+    if (conn.len == 5 && !strncasecmp_P(conn.str, PSTR("close"), 5))
+      return false;
+    if (conn.len == 10 && !strncasecmp_P(conn.str, PSTR("keep-alive"), 10))
+      return true;
+    
+    // HTTP/1.1 connection is persistent by default
+    return (strcmp(req->protocol_version(), "HTTP/1.0") != 0);
+  }
+  
+  // End of body is known only when Content-Length is absent or valid
+  static bool framed(Request* req) {
+    RESTVIEW v = req->header()->get_view(F("Content-Length"));
+    return (v.str == NULL) || (_strtol(v.str, v.len, -1) >= 0);
+  }
+  
+  // Informational and 204 responses never have body, so they carry no Content-Length either
+  static bool bodiless(const __FlashStringHelper* status) {
+    const char PROGMEM* code = (const char PROGMEM*)status + 9;
+    return (pgm_read_byte(&code[0]) == '1') || !strncmp_P("204", code, 3);
+  }
+  
+  // Length of -1 means body of unknown length, which is sent chunked if chunked is true
+  static void sendhead(Transmitter* tx, const __FlashStringHelper* status, Header* ohdr, long length, bool chunked, bool keepalive) {
+    tx->print(status);
+    if (ohdr != NULL && ohdr->transmissible())
+      tx->print(ohdr->str());
+    
+    if (length >= 0 && !bodiless(status)) {
+      tx->print(F("Content-Length: "));
+      tx->print((unsigned long)length);
+      tx->print(HTTP_END_OF_REQUEST);
+    } else if (chunked) {
+      tx->print(F("Transfer-Encoding: chunked\r\n"));
+    }
+    
+    tx->print(F("Connection: "));
+    tx->print((keepalive) ? (F("keep-alive\r\n")) : (F("close\r\n")));
+    tx->print(HTTP_END_OF_REQUEST);
+  }
+  
+  static short addnode(RESTNODE* idx, int idxsz, int* cnt, const char* seg, int segsz) {
+    if (*cnt >= idxsz || segsz > 0xFF)
+      return -1;
+    
+    RESTNODE* n = &(idx[*cnt]);
+    n->seg = seg;
+    n->segsz = segsz;
+    n->child = -1;
+    n->sibling = -1;
+    n->param = -1;
+    n->hdlr = -1;
+    return (*cnt)++;
+  }
+  
+  static short litnode(RESTNODE* idx, int idxsz, int* cnt, short parent, const char* seg, int segsz, bool progmem) {
+    short c;
+    
+    for (c = idx[parent].child;c != -1;c = idx[c].sibling) {
+      if (idx[c].segsz == segsz && ((progmem) ?
+          (_strcmp_P((const __FlashStringHelper*)idx[c].seg, (const __FlashStringHelper*)seg, '/')) :
+          (!strncmp(idx[c].seg, seg, segsz))))
+        return c;
+    }
+    
+    c = addnode(idx, idxsz, cnt, seg, segsz);
+    if (c == -1)
+      return -1;
+    
+    idx[c].sibling = idx[parent].child;
+    idx[parent].child = c;
+    return c;
+  }
+  
+  // Follow segments of URL down from node n, missing nodes are added
+  static short addurl(RESTNODE* idx, int idxsz, int* cnt, short n, const char* url, bool progmem) {
+    int j = 0;
+    
+    while (n != -1) {
+      char c = (progmem) ? (pgm_read_byte(&url[j])) : (url[j]);
+      int fcnt = (progmem) ? (_struntil_P((const __FlashStringHelper*)&url[j], '/')) : (_struntil(&url[j], '/'));
+      
+      if (c == ':') {
+        if (idx[n].param == -1)
+          idx[n].param = addnode(idx, idxsz, cnt, &url[j], fcnt);
+        n = idx[n].param;
+      } else {
+        n = litnode(idx, idxsz, cnt, n, &url[j], fcnt, progmem);
+      }
+      
+      j += fcnt;
+      c = (progmem) ? (pgm_read_byte(&url[j])) : (url[j]);
+      if (n == -1 || c == '\0')
+        break;
+      ++j;
+    }
+    
+    return n;
+  }
+  
+  static bool buildidx(RESTNODE* idx, int idxsz, RESTHANDLER* handler, int len) {
+    int cnt = 0;
+    
+    if (addnode(idx, idxsz, &cnt, NULL, 0) == -1)
+      return false;
+    
+    for (int i = 0;i < len;++i) {
+      RESTHANDLER* h = &(handler[i]);
+      short n = litnode(idx, idxsz, &cnt, 0, h->method, strlen(h->method), false);
+      
+      n = addurl(idx, idxsz, &cnt, n, h->url, false);
+      if (n == -1)
+        return false;
+      
+      // First handler in array order wins as in findhdlr
+      if (idx[n].hdlr == -1)
+        idx[n].hdlr = i;
+    }
+    
+    return true;
+  }
+  
+  // Both literal segment and ':param' wildcard are searched
+  // Smallest handler index wins, so result is the same as first match of findhdlr
+  static short walkidx(const RESTNODE* idx, short n, const char* url, bool progmem) {
+    int ucnt = _struntil(url, '/');
+    bool last = (url[ucnt] == '\0');
+    short h = -1;
+    short p;
+    
+    for (short c = idx[n].child;c != -1;c = idx[c].sibling) {
+      if (idx[c].segsz == ucnt && !((progmem) ? (strncmp_P(url, idx[c].seg, ucnt)) : (strncmp(idx[c].seg, url, ucnt)))) {
+        h = (last) ? (idx[c].hdlr) : (walkidx(idx, c, url + ucnt + 1, progmem));
+        break;
+      }
+    }
+    
+    if (idx[n].param == -1 || ucnt <= 0)
+      return h;
+    
+    p = (last) ? (idx[idx[n].param].hdlr) : (walkidx(idx, idx[n].param, url + ucnt + 1, progmem));
+    return (h == -1 || (p != -1 && p < h)) ? (p) : (h);
+  }
+  
+  static RESTHANDLER* findidx(const RESTNODE* idx, RESTHANDLER* handler, const char* method, Request* req, Response* res) {
+    int methodsz = strlen(method);
+    
+    for (short c = idx[0].child;c != -1;c = idx[c].sibling) {
+      if (idx[c].segsz == methodsz && !strncmp(idx[c].seg, method, methodsz)) {
+        short i = walkidx(idx, c, req->url(), false);
+        if (i == -1)
+          break;
+        
+        RESTHANDLER* h = &(handler[i]);
+        res->status(HTTP_200_OK);
+        req->url_format(h->url);
+        return h;
+      }
+    }
+    
+    return NULL;
+  }
+  
+  // Index of RESTROUTE table keeps segments in flash, method nodes carry method in segsz
+  static bool buildidx_P(RESTNODE* idx, int idxsz, const RESTROUTE* routes, int len) {
+    int cnt = 0;
+    
+    if (addnode(idx, idxsz, &cnt, NULL, 0) == -1)
+      return false;
+    
+    for (int i = 0;i < len;++i) {
+      unsigned char method = pgm_read_byte(&routes[i].method);
+      short n;
+      
+      for (n = idx[0].child;n != -1 && idx[n].segsz != method;n = idx[n].sibling);
+      if (n == -1) {
+        n = addnode(idx, idxsz, &cnt, NULL, method);
+        if (n == -1)
+          return false;
+        
+        idx[n].sibling = idx[0].child;
+        idx[0].child = n;
+      }
+      
+      n = addurl(idx, idxsz, &cnt, n, (const char PROGMEM*)pgm_read_ptr(&routes[i].url), true);
+      if (n == -1)
+        return false;
+      
+      // First route in table order wins as in findroute
+      if (idx[n].hdlr == -1)
+        idx[n].hdlr = i;
+    }
+    
+    return true;
+  }
+  
+  static int findidx_P(const RESTNODE* idx, const RESTROUTE* routes, RESTMETHOD method, Request* req, Response* res, RESTROUTE* route) {
+    for (short c = idx[0].child;c != -1;c = idx[c].sibling) {
+      if (idx[c].segsz == method) {
+        short i = walkidx(idx, c, req->url(), true);
+        if (i == -1)
+          break;
+        
+        memcpy_P(route, &routes[i], sizeof(RESTROUTE));
+        res->status(HTTP_200_OK);
+        req->url_format(route->url, true);
+        return i;
+      }
+    }
+    
+    return -1;
+  }
+  
+public:
+  int buffer_size() const {
+    return this->_bufsz;
+  }
+  
+  int reserved_buffer_size() const {
+    return this->_rbufsz;
+  }
+  
+  int writer_buffer_size() const {
+    return this->_wbufsz;
+  }
+  
+  // Take area for Response::writer from tail of request buffer
+  // Call it before connections because request buffer shrinks
+  void writer_buffer_size(int size) {
+    int total = this->_bufsz + this->_wbufsz;
+    
+    if (size < 0 || size >= total)
+      return;
+    
+    this->_wbufsz = size;
+    this->_bufsz = total - size;
+    this->_wbuf = this->_buf + this->_bufsz;
+    this->_conn.bufsz = this->_bufsz;
+  }
+  
+  int timeout() const {
+    return this->_recvtimeout;
+  }
+  
+  void timeout(int timeout) {
+    this->_recvtimeout = timeout;
+  }
+  
+  int body_timeout() const {
+    return this->_bodytimeout;
+  }
+  
+  void body_timeout(int timeout) {
+    this->_bodytimeout = timeout;
+  }
+  
+  int keepalive_timeout() const {
+    return this->_katimeout;
+  }
+  
+  void keepalive_timeout(int timeout) {
+    this->_katimeout = timeout;
+  }
+  
+  // Maximum requests served on one connection, 1 disables persistent connection
+  int keepalive_requests() const {
+    return this->_kamax;
+  }
+  
+  void keepalive_requests(int requests) {
+    this->_kamax = requests;
+  }
+  
+  // Request declaring longer body is refused with 413 before handler runs, -1 means no limit
+  long content_length_limit() const {
+    return this->_bodymax;
+  }
+  
+  void content_length_limit(long limit) {
+    this->_bodymax = limit;
+  }
+  
+  // Responses of handlers flagged RESTFUL_CACHEABLE are kept in given area
+  void cache(char* buf, int bufsz) {
+    this->_cache = buf;
+    this->_cachesz = bufsz;
+    this->_cachepos = 0;
+  }
+  
+  // Drop every cached response, call it when data behind cached handlers changes
+  // Version is part of ETag, so clients revalidating older tags get whole response
+  void invalidate() {
+    this->_cachepos = 0;
+    this->_cachever++;
+  }
+  
+  unsigned long cache_version() const {
+    return this->_cachever;
+  }
+  
+  // Only listed header fields are stored, others are dropped while request is received
+  // Fields used by RESTful itself are always kept, NULL keeps every field
+  void header_filter(const char* const* keys, int keysz) {
+    this->_filter = keys;
+    this->_filtersz = keysz;
+  }
+  
+  // Deferred handlers are parked in given slots by poll and service
+  // Handler is called again without returning while slots are full and in loop
+  void deferrals(RESTDEFERRED* slots, int slotsz) {
+    for (int i = 0;i < slotsz;++i)
+      slots[i].used = false;
+    
+    this->_defer = slots;
+    this->_defersz = slotsz;
+  }
+  
+  // Event stream clients are kept in given table, events are formatted once in given buffer
+  void subscribers(RESTSUBSCRIBER* subs, int subsz, char* buf, int bufsz) {
+    for (int i = 0;i < subsz;++i)
+      subs[i].used = false;
+    
+    this->_subs = subs;
+    this->_subsz = subsz;
+    this->_evbuf = buf;
+    this->_evbufsz = bufsz;
+  }
+  
+  int subscriber_count() const {
+    int n = 0;
+    
+    for (int i = 0;i < this->_subsz;++i)
+      n += (this->_subs[i].used) ? (1) : (0);
+    
+    return n;
+  }
+  
+  // Subscriber whose write takes longer than this is dropped
+  int event_timeout() const {
+    return this->_evtimeout;
+  }
+  
+  void event_timeout(int timeout) {
+    this->_evtimeout = timeout;
+  }
+  
+  // Send event to every subscriber, each line of data becomes a data field
+  // Returns number of subscribers reached, -1 if event does not fit in buffer
+  int broadcast(const char* event, const char* data) {
+    int pos = 0;
+    int n = 0;
+    bool ok = true;
+    
+    if (event != NULL) {
+      ok = mcat(this->_evbuf, this->_evbufsz, &pos, F("event: ")) &&
+        mcat(this->_evbuf, this->_evbufsz, &pos, event) && mcat(this->_evbuf, this->_evbufsz, &pos, F("\n"));
+    }
+    
+    for (const char* line = data;ok;) {
+      int linesz = _struntil(line, '\n');
+      
+      ok = mcat(this->_evbuf, this->_evbufsz, &pos, F("data: ")) &&
+        mcat(this->_evbuf, this->_evbufsz, &pos, line, linesz) && mcat(this->_evbuf, this->_evbufsz, &pos, F("\n"));
+      if (line[linesz] == '\0')
+        break;
+      line += linesz + 1;
+    }
+    
+    if (!ok || !mcat(this->_evbuf, this->_evbufsz, &pos, F("\n")))
+      return -1;
+    
+    for (int i = 0;i < this->_subsz;++i) {
+      RESTSUBSCRIBER* sub = &this->_subs[i];
+      unsigned long ts = millis();
+      
+      if (!sub->used)
+        continue;
+      
+      // Dead, refusing or slow subscriber is evicted
+      if (!sub->client.connected() || sub->client.write((const uint8_t*)this->_evbuf, pos) != (size_t)pos ||
+          timeover(ts, this->_evtimeout)) {
+        sub->client.stop();
+        sub->used = false;
+        continue;
+      }
+      
+      ++n;
+    }
+    
+    return n;
+  }
+  
+  // Assets are searched when no handler matches GET or HEAD request
+  void assets(const RESTASSET* assets, int assetsz) {
+    this->_assets = assets;
+    this->_assetsz = assetsz;
+  }
+
+private:
+  void init(char* buf, int bufsz, int rbufsz) {
+    this->_rbufsz = rbufsz;
+    this->_bufsz = bufsz - rbufsz;
+    this->_rbuf = buf + this->_bufsz;
+    this->_buf = buf;
+    this->_wbuf = NULL;
+    this->_wbufsz = 0;
+    this->_hdlr = NULL;
+    this->_hdlrsz = 0;
+    this->_routes = NULL;
+    this->_routesz = 0;
+    this->_assets = NULL;
+    this->_assetsz = 0;
+    this->_filter = NULL;
+    this->_filtersz = 0;
+    this->_subs = NULL;
+    this->_subsz = 0;
+    this->_defer = NULL;
+    this->_defersz = 0;
+    this->_evbuf = NULL;
+    this->_evbufsz = 0;
+    this->_evtimeout = 100;
+    this->_idx = NULL;
+    this->_recvtimeout = 7000;
+    this->_bodytimeout = 7000;
+    this->_katimeout = 5000;
+    this->_kamax = 1;
+    this->_bodymax = -1;
+    this->_conn.buf = this->_buf;
+    this->_conn.bufsz = this->_bufsz;
+    this->_conn.active = false;
+    this->_conn.nreq = 0;
+    this->_conn.deferred = NULL;
+    this->_conn.nextsz = 0;
+    this->_conn.skipsz = 0;
+    this->_pool = NULL;
+    this->_poolsz = 0;
+    this->_rr = 0;
+    this->_cache = NULL;
+    this->_cachesz = 0;
+    this->_cachepos = 0;
+    this->_cachever = 0;
+#ifdef RESTFUL_METRICS
+    memset(&this->_metrics, 0x00, sizeof(this->_metrics));
+    this->_mline = 0;
+#endif
+  }
+  
+public:
+  RESTful(char* buf, int bufsz, int rbufsz, RESTHANDLER* handler, int hdlrsz) {
+    this->init(buf, bufsz, rbufsz);
+    this->_hdlr = handler;
+    this->_hdlrsz = hdlrsz;
+  }
+  
+  // Route index is optional, handler array is scanned linearly if index does not fit
+  RESTful(char* buf, int bufsz, int rbufsz, RESTHANDLER* handler, int hdlrsz, RESTNODE* index, int indexsz) {
+    this->init(buf, bufsz, rbufsz);
+    this->_hdlr = handler;
+    this->_hdlrsz = hdlrsz;
+    this->_idx = (buildidx(index, indexsz, handler, hdlrsz)) ? (index) : (NULL);
+  }
+  
+  // Route table placed in PROGMEM does not consume SRAM
+  RESTful(char* buf, int bufsz, int rbufsz, const RESTROUTE* routes, int routesz) {
+    this->init(buf, bufsz, rbufsz);
+    this->_routes = routes;
+    this->_routesz = routesz;
+  }
+  
+  // Index of route table is built in SRAM once, table is scanned linearly if index does not fit
+  RESTful(char* buf, int bufsz, int rbufsz, const RESTROUTE* routes, int routesz, RESTNODE* index, int indexsz) {
+    this->init(buf, bufsz, rbufsz);
+    this->_routes = routes;
+    this->_routesz = routesz;
+    this->_idx = (buildidx_P(index, indexsz, routes, routesz)) ? (index) : (NULL);
+  }
+  
+private:
+  // Build, dispatch and respond to received request, returns whether connection persists
+  // Deferred handler is parked and unread body is dropped later if connection is polled
+  bool process(RESTCLIENT& client, RESTCONNECTION* conn, int presz, bool persist, bool polled) {
+    Header ihdr;
+    Header ohdr;
+    Request req(&ihdr);
+    Response res(&ohdr);
+    Writer writer(this->_wbuf, this->_wbufsz);
+    RESTROUTE route;
+    RESTCALLBACK callback = NULL;
+#ifdef RESTFUL_BATCH
+    RESTBATCH batch;
+#endif
+    RESTCACHEENTRY entry;
+    bool cacheable = false;
+    int cached = -1;
+    int ri = -1;
+    const RESTASSET* asset = NULL;
+    bool gz = false;
+    bool upgrade = false;
+    bool subscribe = false;
+    char accept[29];
+    
+    // Build request and response object
+    buildreq(conn->buf, conn->bufsz, this->_rbuf, this->_rbufsz, presz, &req, &res);
+    req._client = &client;
+    req._bodytimeout = this->_bodytimeout;
+    req._bodybegin = millis();
+    res._writer = &writer;
+    conn->detached = false;
+    
+    // Check request is valid
+    if (req.failed()) {
+#ifdef RESTFUL_METRICS
+      this->_metrics.parse_failures++;
+#endif
+      reject(client, conn, HTTP_400_BAD_REQUEST);
+      return false;
+    }
+    
+    // Refuse body before client uploads it
+    if (this->_bodymax >= 0 && req.content_length() > this->_bodymax) {
+#ifdef RESTFUL_METRICS
+      this->_metrics.overflows++;
+#endif
+      reject(client, conn, HTTP_413_REQUEST_ENTITY_TOO_LARGE);
+      return false;
+    }
+    
+    // Chunked body can not be told apart from next request, so it is never read
+    if (req.header()->get_view(F("Transfer-Encoding")).str != NULL) {
+#ifdef RESTFUL_METRICS
+      this->_metrics.parse_failures++;
+#endif
+      reject(client, conn, HTTP_411_LENGTH_REQUIRED);
+      return false;
+    }
+    
+    // Body of invalid length can not be told apart from next request either
+    if (!framed(&req)) {
+#ifdef RESTFUL_METRICS
+      this->_metrics.parse_failures++;
+#endif
+      reject(client, conn, HTTP_400_BAD_REQUEST);
+      return false;
+    }
+    
+#ifdef RESTFUL_METRICS
+    if (req.method_id() == REST_GET && !strcmp(req.url(), RESTFUL_METRICS_URL)) {
+      res.status(HTTP_200_OK);
+      ohdr.set(F("Content-Type"), F("text/plain; version=0.0.4"));
+      res.stream(mproduce, this);
+      this->_mline = 0;
+    } else
+#endif
+#ifdef RESTFUL_BATCH
+    if (req.method_id() == REST_POST && !strcmp(req.url(), RESTFUL_BATCH_URL)) {
+      const __FlashStringHelper* status = this->collect(conn, &req);
+      
+      if (status == NULL) {
+        res.status(HTTP_200_OK);
+        ohdr.set(F("Content-Type"), F("text/plain"));
+        res.stream(bproduce, &batch);
+        batch.rest = this;
+        batch.batch = &req;
+        batch.client = &client;
+        batch.next = req._body;
+        batch.end = req._body + max(req._length, 0L);
+        batch.res._writer = &writer;
+      } else {
+        res.status(status);
+      }
+    } else
+#endif
+    // Unknown method is refused before searching handler, unless a handler is registered with it
+    if (req.method_id() == REST_UNKNOWN && !this->implemented(req.method())) {
+      res.status(HTTP_501_NOT_IMPLEMENTED);
+    } else if (req.method_id() == REST_OPTIONS) {
+      unsigned int mask = this->allowed(&req);
+      
+      if (mask != 0)
+        this->allow(&req, &res, mask, HTTP_204_NO_CONTENT);
+    } else {
+      // Search request handler
+      ri = this->find(&req, &res, &route);
+      callback = route.request_callback;
+      
+      // Cached response is sent without running handler
+      cacheable = (ri >= 0) && (route.flags & RESTFUL_CACHEABLE) && (this->_cache != NULL) &&
+        (req.method_id() == REST_GET || req.method_id() == REST_HEAD);
+      if (cacheable)
+        cached = this->cachefind(&req, &entry);
+      
+      // Handler accepts upgrade by leaving status 101
+      int u = ((ri >= 0) && (route.flags & RESTFUL_WEBSOCKET)) ? (upgrading(&req, accept)) : (0);
+      upgrade = (u > 0);
+      if (upgrade)
+        res.status(HTTP_101_SWITCHING_PROTOCOLS);
+      
+      // Refused upgrade is answered without running handler
+      if (u < 0) {
+        res.status((u == -1) ? (HTTP_400_BAD_REQUEST) : (HTTP_426_UPGRADE_REQUIRED));
+        if (u == -2)
+          ohdr.set(F("Sec-WebSocket-Version"), F("13"));
+        callback = NULL;
+        cached = -1;
+      }
+      subscribe = (ri >= 0) && (route.flags & RESTFUL_EVENTSTREAM) && (req.method_id() == REST_GET);
+      
+      if (ri < 0 && (req.method_id() == REST_GET || req.method_id() == REST_HEAD))
+        asset = this->findasset(&req, &res, &gz);
+      
+      // Path is known but method is not
+      if (ri < 0 && asset == NULL) {
+        unsigned int mask = this->allowed(&req);
+        
+        if (mask != 0)
+          this->allow(&req, &res, mask, HTTP_405_METHOD_NOT_ALLOWED);
+      }
+    }
+    
+    // Bytes behind declared body are kept as next pipelined request
+    persist = persist && keepalive(&req);
+    
+    // Client waiting for interim response sends body after it, so without one body never comes
+    bool waiting = (req.remaining() > req.body_length()) && expects(&req);
+    if (waiting && (callback == NULL || cached >= 0))
+      persist = false;
+    
+    // Process request
+#ifdef RESTFUL_METRICS
+    unsigned long ts = millis();
+#endif
+    if (callback != NULL && cached < 0) {
+      if (waiting)
+        proceed(client);
+      callback(&req, &res, &client);
+      
+      // Deferred handler is parked, or called again here when it can not be
+      if (res._deferred) {
+        if (polled && this->park(conn, &req, &res, &route, callback, ri, persist))
+          return true;
+        this->await(&req, &res, callback, &client);
+      }
+    }
+    
+    upgrade = upgrade && !strncmp_P("101", (const char PROGMEM*)res.status() + 9, 3);
+    subscribe = subscribe && !strncmp_P("200", (const char PROGMEM*)res.status() + 9, 3);
+    if (subscribe && this->subscribe(client) == NULL) {
+      res.status(HTTP_503_SERVICE_UNAVAILABLE);
+      subscribe = false;
+    }
+    
+    // Truncated body is never sent
+    if (writer.overflow()) {
+      res.status(HTTP_500_INTERNAL_SERVER_ERROR);
+      writer._pos = 0;
+    }
+#ifdef RESTFUL_METRICS
+    record(&this->_metrics.dispatch, millis() - ts);
+#endif
+    
+    // Unread body is dropped to reach next request
+    if (persist && req.remaining() > 0)
+      persist = discard(&req, conn, polled);
+    
+    // Only 200 response of non-streaming handler is cached
+    if (cacheable && cached < 0 && !res.use_stream() &&
+        res.status() != NULL && !strncmp_P("200", (const char PROGMEM*)res.status() + 9, 3))
+      cached = this->cachestore(&req, &res, &entry);
+    
+    // Validator is checked before request buffer is reused for transmission
+    bool fresh = (cached >= 0) && this->cachefresh(&req, cached);
+    
+    // Request buffer is no longer used, so reuse it for transmission behind pipelined bytes
+    // Streamed body may still read request, otherwise pipelined bytes are moved to buffer start
+    int keep = (upgrade || subscribe) ? (0) : (pipeline(conn, &req, &persist, !res.use_stream()));
+#ifdef RESTFUL_BATCH
+    // Lines of batch are read while its response is transmitted
+    if (batch.end != NULL)
+      keep = max(keep, (int)(batch.end - conn->buf));
+#endif
+    Transmitter tx(&client, conn->buf + keep, conn->bufsz - keep);
+#ifdef RESTFUL_METRICS
+    ts = millis();
+#endif
+    
+    if (upgrade || subscribe) {
+      if (upgrade)
+        handshake(&tx, &res, accept);
+      else
+        eventstream(&tx, &res);
+      conn->detached = true;
+      persist = false;
+    } else if (asset != NULL)
+      persist = assetsend(&tx, &req, &res, asset, gz, persist);
+    else if (cached >= 0)
+      persist = this->cachesend(&tx, &req, cached, fresh, persist);
+    else
+      persist = respond(&tx, &req, &res, persist);
+    
+    // Response cut short leaves peer out of step, so it is not kept
+    persist = persist && !tx._failed;
+    
+#ifdef RESTFUL_METRICS
+    record(&this->_metrics.send, millis() - ts);
+    record(&this->_metrics.receive, conn->ts - conn->begin);
+    
+    if (callback == NULL && (res.use_stream() || asset != NULL))
+      return persist;
+    
+    // Request without route is counted by its status, refused upgrade is counted on its route
+    if (ri < 0) {
+      const char PROGMEM* status = (const char PROGMEM*)res.status() + 9;
+      
+      if (!strncmp_P("404", status, 3))
+        this->_metrics.not_found++;
+      else if (!strncmp_P("405", status, 3))
+        this->_metrics.not_allowed++;
+      else if (!strncmp_P("501", status, 3))
+        this->_metrics.not_implemented++;
+      return persist;
+    }
+    
+    this->tally(ri, &req, &res, conn, tx._sent);
+#endif
+    return persist;
+  }
+  
+#ifdef RESTFUL_METRICS
+  void tally(int ri, Request* req, Response* res, RESTCONNECTION* conn, unsigned long sent) {
+    if (ri < RESTFUL_METRICS_ROUTES) {
+      RESTROUTEMETRICS* m = &this->_metrics.route[ri];
+      char c = pgm_read_byte((const char PROGMEM*)res->status() + 9);
+      
+      m->hits++;
+      m->client_errors += (c == '4') ? (1) : (0);
+      m->server_errors += (c == '5') ? (1) : (0);
+      m->bytes_in += conn->scansz + ((req->content_length() > 0) ? (req->content_length() - req->remaining()) : (0));
+      m->bytes_out += sent;
+    }
+  }
+#endif
+  
+  // Clear response for another call of deferred handler
+  static void renew(Response* res) {
+    Header* ohdr = res->_hdr;
+    Writer* writer = res->_writer;
+    
+    *res = Response(ohdr);
+    res->_writer = writer;
+    if (writer != NULL)
+      writer->clear();
+    if (ohdr != NULL && ohdr->available()) {
+      ohdr->_buf[0] = '\0';
+      ohdr->_pos = 0;
+    }
+  }
+  
+  // Call deferred handler until it completes or times out
+  static void await(Request* req, Response* res, RESTCALLBACK callback, RESTCLIENT* client) {
+    unsigned long ts = millis();
+    
+    while (res->_deferred) {
+      bool expired = timeover(ts, res->_timeout);
+      
+      req->_state = res->_state;
+      renew(res);
+      if (expired) {
+        res->status(HTTP_504_GATEWAY_TIME_OUT);
+        return;
+      }
+      
+      res->status(HTTP_200_OK);
+      callback(req, res, client);
+    }
+  }
+  
+  // Copy request into free slot, copied request refers to its own header
+  bool park(RESTCONNECTION* conn, Request* req, Response* res, RESTROUTE* route, RESTCALLBACK callback, int ri, bool persist) {
+    for (int i = 0;i < this->_defersz;++i) {
+      RESTDEFERRED* d = &this->_defer[i];
+      
+      if (d->used)
+        continue;
+      
+      d->ihdr = *req->header();
+      d->req = *req;
+      d->req._hdr = &d->ihdr;
+      d->req._state = res->_state;
+      d->ihdr._fields = d->req._fields;
+      d->route = *route;
+      
+      d->callback = callback;
+      d->ri = ri;
+      d->ts = millis();
+      d->timeout = res->_timeout;
+      d->persist = persist;
+      d->used = true;
+      conn->deferred = d;
+      return true;
+    }
+    
+    return false;
+  }
+  
+  // Call parked handler again, connection is answered when it completes or times out
+  int resume(RESTCLIENT& client, RESTCONNECTION* conn) {
+    RESTDEFERRED* d = conn->deferred;
+    Header ohdr;
+    Response res(&ohdr);
+    Writer writer(this->_wbuf, this->_wbufsz);
+    
+    if (this->_rbufsz) {
+      this->_rbuf[0] = '\0';
+      ohdr.setbuf(this->_rbuf, this->_rbufsz);
+    }
+    res._writer = &writer;
+    d->req._client = &client;
+    
+    // Peer went away while handler was pending
+    if (!client.connected()) {
+      conn->deferred = NULL;
+      conn->active = false;
+      conn->nreq = 0;
+      d->used = false;
+      client.stop();
+      return RESTFUL_CLOSED;
+    }
+    
+    if (timeover(d->ts, d->timeout)) {
+      res.status(HTTP_504_GATEWAY_TIME_OUT);
+    } else {
+      res.status(HTTP_200_OK);
+      d->callback(&d->req, &res, &client);
+      
+      if (res._deferred) {
+        d->req._state = res._state;
+        d->timeout = res._timeout;
+        return RESTFUL_NEED_MORE;
+      }
+    }
+    
+    conn->deferred = NULL;
+    d->used = false;
+    
+    if (this->reply(client, conn, &d->req, &res, d->ri, d->persist)) {
+      nextconn(conn);
+      conn->active = true;
+      return RESTFUL_DISPATCHED;
+    }
+    
+    conn->active = false;
+    conn->nreq = 0;
+    client.stop();
+    return RESTFUL_DISPATCHED;
+  }
+  
+  // Send response of resumed handler, returns whether connection persists
+  bool reply(RESTCLIENT& client, RESTCONNECTION* conn, Request* req, Response* res, int ri, bool persist) {
+    if (res->_writer->overflow()) {
+      res->status(HTTP_500_INTERNAL_SERVER_ERROR);
+      res->_writer->_pos = 0;
+    }
+    
+    if (persist && req->remaining() > 0)
+      persist = discard(req, conn, true);
+    
+    int keep = pipeline(conn, req, &persist, !res->use_stream());
+    Transmitter tx(&client, conn->buf + keep, conn->bufsz - keep);
+    persist = respond(&tx, req, res, persist) && !tx._failed;
+#ifdef RESTFUL_METRICS
+    this->tally(ri, req, res, conn, tx._sent);
+#else
+    (void)ri;
+#endif
+    return persist;
+  }
+  
+  // Constant body takes precedence over writer, writer over String body
+  static long bodylength(Response* res) {
+    if (res->use_constbody())
+      return strlen_P((const char PROGMEM*)res->constbody());
+    if (res->use_writer())
+      return res->writer()->length();
+    return res->body().length();
+  }
+  
+  // Send status line, header fields and body, returns whether connection persists
+  // Body of HEAD request is not sent
+  static bool respond(Transmitter* tx, Request* req, Response* res, bool persist) {
+    bool head = (req->method_id() == REST_HEAD);
+    
+    // Streamed body of HTTP/1.0 ends by closing connection
+    if (res->use_stream()) {
+      bool chunked = strcmp(req->protocol_version(), "HTTP/1.0") != 0;
+      
+      persist = persist && (chunked || head);
+      sendhead(tx, res->status(), res->header(), -1, chunked, persist);
+      if (!head)
+        tx->stream(res->_stream, res->_context, chunked);
+      tx->flush();
+      return persist;
+    }
+    
+    long length = bodylength(res);
+    
+    // Send response and header fields
+    sendhead(tx, res->status(), res->header(), length, false, persist);
+    
+    // Send response body
+    if (!head) {
+      if (res->use_constbody())
+        tx->print(res->constbody());
+      else if (res->use_writer())
+        tx->write(res->writer()->str(), res->writer()->length());
+      else
+        tx->print(res->body());
+    }
+    tx->flush();
+    return persist;
+  }
+  
+  // Append to buffer, returns false if it does not fit
+  static bool mcat(char* buf, int bufsz, int* pos, const char* s) {
+    return mcat(buf, bufsz, pos, s, strlen(s));
+  }
+  
+  static bool mcat(char* buf, int bufsz, int* pos, const char* s, int n) {
+    if (*pos + n > bufsz)
+      return false;
+    
+    memcpy(&buf[*pos], s, n);
+    *pos += n;
+    return true;
+  }
+  
+  static bool mcat(char* buf, int bufsz, int* pos, const __FlashStringHelper* s) {
+    int n = strlen_P((const char PROGMEM*)s);
+    
+    if (*pos + n > bufsz)
+      return false;
+    
+    memcpy_P(&buf[*pos], (const char PROGMEM*)s, n);
+    *pos += n;
+    return true;
+  }
+  
+  static bool mcat(char* buf, int bufsz, int* pos, unsigned long v) {
+    char num[21];
+    int i = sizeof(num) - 1;
+    
+    num[i] = '\0';
+    do {
+      num[--i] = '0' + (v % 10);
+      v /= 10;
+    } while (v != 0);
+    
+    return mcat(buf, bufsz, pos, &num[i]);
+  }
+  
+#ifdef RESTFUL_METRICS
+  static void record(RESTHISTOGRAM* h, unsigned long ms) {
+    int i = 0;
+    
+    while (i < RESTFUL_METRICS_BUCKETS - 1 && (1UL << i) < ms)
+      ++i;
+    
+    h->bucket[i]++;
+    h->sum += ms;
+    h->count++;
+  }
+  
+  // Render k-th line of metrics, returns 1 if rendered, 0 if it does not fit and -1 after last line
+  int mline(int k, char* buf, int bufsz, int* pos) {
+    const RESTMETRICS* m = &this->_metrics;
+    int routes = min((this->_routes != NULL) ? (this->_routesz) : (this->_hdlrsz), RESTFUL_METRICS_ROUTES);
+    bool ok = true;
+    
+    // Global counters
+    if (k < 6) {
+      const __FlashStringHelper* name[] = {
+        F("restful_timeouts_total "), F("restful_parse_failures_total "),
+        F("restful_overflows_total "), F("restful_not_found_total "),
+        F("restful_method_not_allowed_total "), F("restful_not_implemented_total ")
+      };
+      unsigned long value[] = { m->timeouts, m->parse_failures, m->overflows, m->not_found, m->not_allowed, m->not_implemented };
+      
+      ok = mcat(buf, bufsz, pos, name[k]) && mcat(buf, bufsz, pos, value[k]);
+      return (ok && mcat(buf, bufsz, pos, F("\n"))) ? (1) : (0);
+    }
+    k -= 6;
+    
+    // Per-route counters
+    if (k < routes * 5) {
+      const __FlashStringHelper* name[] = {
+        F("restful_requests_total{method=\""), F("restful_client_errors_total{method=\""),
+        F("restful_server_errors_total{method=\""), F("restful_received_bytes_total{method=\""),
+        F("restful_sent_bytes_total{method=\"")
+      };
+      const RESTROUTEMETRICS* r = &m->route[k / 5];
+      const RESTROUTE* rt = &this->_routes[k / 5];
+      unsigned long value[] = { r->hits, r->client_errors, r->server_errors, r->bytes_in, r->bytes_out };
+      
+      ok = mcat(buf, bufsz, pos, name[k % 5]) && ((this->_routes != NULL) ?
+          (mcat(buf, bufsz, pos, _methodname((RESTMETHOD)pgm_read_byte(&rt->method)))) :
+          (mcat(buf, bufsz, pos, this->_hdlr[k / 5].method))) &&
+        mcat(buf, bufsz, pos, F("\",route=\"")) && ((this->_routes != NULL) ?
+          (mcat(buf, bufsz, pos, (const __FlashStringHelper*)pgm_read_ptr(&rt->url))) :
+          (mcat(buf, bufsz, pos, this->_hdlr[k / 5].url))) &&
+        mcat(buf, bufsz, pos, F("\"} ")) &&
+        mcat(buf, bufsz, pos, value[k % 5]);
+      return (ok && mcat(buf, bufsz, pos, F("\n"))) ? (1) : (0);
+    }
+    k -= routes * 5;
+    
+    // Latency histograms
+    if (k < 3 * (RESTFUL_METRICS_BUCKETS + 3)) {
+      const __FlashStringHelper* name[] = {
+        F("restful_receive_milliseconds"), F("restful_dispatch_milliseconds"), F("restful_send_milliseconds")
+      };
+      const RESTHISTOGRAM* h[] = { &m->receive, &m->dispatch, &m->send };
+      int j = k / (RESTFUL_METRICS_BUCKETS + 3);
+      int b = k % (RESTFUL_METRICS_BUCKETS + 3);
+      
+      if (b == 0) {
+        ok = mcat(buf, bufsz, pos, F("# TYPE ")) &&
+          mcat(buf, bufsz, pos, name[j]) &&
+          mcat(buf, bufsz, pos, F(" histogram"));
+      } else if (b <= RESTFUL_METRICS_BUCKETS) {
+        unsigned long cnt = 0;
+        
+        for (int i = 0;i < b;++i)
+          cnt += h[j]->bucket[i];
+        
+        ok = mcat(buf, bufsz, pos, name[j]) &&
+          mcat(buf, bufsz, pos, F("_bucket{le=\"")) &&
+          ((b < RESTFUL_METRICS_BUCKETS) ?
+            (mcat(buf, bufsz, pos, 1UL << (b - 1))) : (mcat(buf, bufsz, pos, F("+Inf")))) &&
+          mcat(buf, bufsz, pos, F("\"} ")) &&
+          mcat(buf, bufsz, pos, cnt);
+      } else {
+        bool sum = (b == RESTFUL_METRICS_BUCKETS + 1);
+        
+        ok = mcat(buf, bufsz, pos, name[j]) &&
+          mcat(buf, bufsz, pos, (sum) ? (F("_sum ")) : (F("_count "))) &&
+          mcat(buf, bufsz, pos, (sum) ? (h[j]->sum) : (h[j]->count));
+      }
+      return (ok && mcat(buf, bufsz, pos, F("\n"))) ? (1) : (0);
+    }
+    
+    return -1;
+  }
   
-private:
-  int _recvtimeout;
+  // Producer of metrics response, renders as many whole lines as fit in each block
+  static int mproduce(char* buf, int bufsz, void* context) {
+    RESTful* rest = (RESTful*)context;
+    int pos = 0;
+    
+    while (true) {
+      int begin = pos;
+      int r = rest->mline(rest->_mline, buf, bufsz, &pos);
+      
+      if (r < 0)
+        break;
+      
+      // Line longer than whole block is skipped
+      if (r == 0) {
+        pos = begin;
+        if (begin > 0)
+          break;
+      }
+      
+      rest->_mline++;
+    }
+    
+    return pos;
+  }
+#endif
   
-private:
-  static void buildreq(char* buf, int bufsz, int rbufsz, Request* req, Response* res) {
-    int eor = _struntil(buf, '\r');
-    char* hdrstr = buf + eor + 2;
+#ifdef RESTFUL_BATCH
+  // Whole batch body is received behind its part received with header
+  // Returns NULL on success, otherwise status of failure
+  const __FlashStringHelper* collect(RESTCONNECTION* conn, Request* req) {
+    long length = max(req->_length, 0L);
+    int have = (int)min((long)req->_bodysz, length);
+    char* end = req->_body + req->_bodysz;
     
-    buf[eor] = '\0';
-    res->status(HTTP_404_NOT_FOUND);
-    req->setbuf(buf);
-    req->header()->setbuf(hdrstr, bufsz - (eor + 2));
+    if (length - have > conn->bufsz - RESTFUL_TRANSMIT_MIN_SIZE - (end - conn->buf))
+      return HTTP_413_REQUEST_ENTITY_TOO_LARGE;
     
-    if (res->header() && rbufsz) {
-      buf[bufsz] = '\0';
-      res->header()->setbuf(buf + bufsz, rbufsz);
+    // Rest of body is appended to received part
+    req->_bodypos = have;
+    req->_remaining = length - have;
+    while (req->_remaining > 0) {
+      int n = req->read(end, req->_remaining);
+      
+      if (n <= 0)
+        return HTTP_408_REQUEST_TIME_OUT;
+      end += n;
+      req->_bodysz += n;
+      req->_bodypos += n;
     }
+    
+    return NULL;
   }
   
-  static bool recvall(EthernetClient* client, unsigned long interval, char* buf, int bufsz) {
-    unsigned long ts = millis();
-    int recvsz = 0;
-    bool isblank = true;
+  // Run one call of batch, line is "<method> <url>"
+  void bcall(RESTBATCH* b, const char* line, int n) {
+    Request q(b->batch->_hdr);
+    Response* res = &b->res;
+    RESTROUTE route;
     
-    while ((recvsz < bufsz - 1) && !timeover(ts, interval) && client->connected()) {
-      if (!client->available())
-        continue;
+    renew(res);
+    res->status(HTTP_404_NOT_FOUND);
+    if (n >= RESTFUL_BATCH_LINE_SIZE) {
+      res->status(HTTP_414_REQUEST_URI_TOO_LARGE);
+      return;
+    }
+    
+    memcpy(b->line, line, n);
+    b->line[n] = '\0';
+    q._method = strtok(b->line, " ");
+    q._url = (q._method != NULL) ? (strtok(NULL, " ")) : (NULL);
+    if (q._url == NULL) {
+      res->status(HTTP_400_BAD_REQUEST);
+      return;
+    }
+    
+    strtok(q._url, "?");
+    q._query = strtok(NULL, "?");
+    q._methodid = _parsemethod(q._method);
+    q._protocol_version = b->batch->_protocol_version;
+    q._client = b->client;
+    q._failed = false;
+    
+    this->find(&q, res, &route);
+    if (route.request_callback == NULL)
+      return;
+    
+    // Connection can not be taken over by a call of batch
+    if (route.flags & (RESTFUL_WEBSOCKET | RESTFUL_EVENTSTREAM)) {
+      res->status(HTTP_501_NOT_IMPLEMENTED);
+      return;
+    }
+    
+    route.request_callback(&q, res, b->client);
+    if (res->_deferred)
+      await(&q, res, route.request_callback, b->client);
+    
+    // Streamed or truncated body has no length to prefix
+    if (res->use_stream()) {
+      renew(res);
+      res->status(HTTP_501_NOT_IMPLEMENTED);
+    } else if (res->_writer->overflow()) {
+      renew(res);
+      res->status(HTTP_500_INTERNAL_SERVER_ERROR);
+    }
+  }
+  
+  // Run next call of batch and prepare its result, returns false when there is none
+  bool bnext(RESTBATCH* b) {
+    while (b->next < b->end) {
+      char* line = b->next;
+      char* eol = (char*)memchr(line, '\n', b->end - line);
+      int n = ((eol != NULL) ? (eol) : (b->end)) - line;
+      Response* res = &b->res;
       
-      char c = client->read();
-      buf[recvsz++] = c;
+      b->next = (eol != NULL) ? (eol + 1) : (b->end);
+      if (n > 0 && line[n - 1] == '\r')
+        --n;
+      if (n == 0)
+        continue;
       
-      if ((c == '\n') && isblank) {
-        buf[recvsz] = '\0';
-        return true;
-      }
+      this->bcall(b, line, n);
       
-      isblank = ((c == '\n') ? (true) : ((c == '\r') ? isblank : false));
-      ts = millis();
+      b->flash = res->use_constbody();
+      b->body = (b->flash) ? ((const char*)res->constbody()) :
+        ((res->use_writer()) ? (res->writer()->str()) : (res->body().c_str()));
+      b->bodysz = bodylength(res);
+      memcpy_P(b->head, (const char PROGMEM*)res->status() + 9, 3);
+      b->headsz = 3;
+      mcat(b->head, sizeof(b->head), &b->headsz, " ", 1);
+      mcat(b->head, sizeof(b->head), &b->headsz, (unsigned long)b->bodysz);
+      mcat(b->head, sizeof(b->head), &b->headsz, "\r\n", 2);
+      b->pos = 0;
+      b->pending = true;
+      return true;
     }
     
     return false;
   }
   
-  static bool urlmatch(const char* format, const char* url) {
-    int i = 0;
-    int j = 0;
+  // Producer of batch response, each result is "<status code> <body length>\r\n<body>\r\n"
+  // Result longer than block continues in next block
+  static int bproduce(char* buf, int bufsz, void* context) {
+    RESTBATCH* b = (RESTBATCH*)context;
+    int pos = 0;
     
-    while(true) {
-      int fcnt = _struntil(&format[i], '/');
-      int ucnt = _struntil(&url[j], '/');
+    while (pos < bufsz && (b->pending || b->rest->bnext(b))) {
+      long total = b->headsz + b->bodysz + 2;
       
-      if(!_strcmp(&format[i], &url[j], '/')) {
-        if(format[i] != ':' || ucnt <= 0)
-          return false;
+      while (pos < bufsz && b->pos < total) {
+        long off = b->pos;
+        int m;
+        
+        if (off < b->headsz) {
+          m = (int)min((long)(bufsz - pos), b->headsz - off);
+          memcpy(&buf[pos], &b->head[off], m);
+        } else if (off < b->headsz + b->bodysz) {
+          off -= b->headsz;
+          m = (int)min((long)(bufsz - pos), b->bodysz - off);
+          if (b->flash)
+            memcpy_P(&buf[pos], (const char PROGMEM*)b->body + off, m);
+          else
+            memcpy(&buf[pos], b->body + off, m);
+        } else {
+          off -= b->headsz + b->bodysz;
+          m = (int)min((long)(bufsz - pos), 2 - off);
+          memcpy(&buf[pos], "\r\n" + off, m);
+        }
+        
+        pos += m;
+        b->pos += m;
       }
       
-      i += (fcnt);
-      j += (ucnt);
+      if (b->pos == total)
+        b->pending = false;
+    }
+    
+    return pos;
+  }
+#endif
+  
+  // Returns index of handler matching request, -1 if nothing matches
+  // Callback and flags of matched handler are stored in route
+  // HEAD request without HEAD handler is dispatched to GET handler
+  int find(Request* req, Response* res, RESTROUTE* route) {
+    int ri = this->lookup(req->method_id(), req->method(), req, res, route);
+    
+    if (ri < 0 && req->method_id() == REST_HEAD)
+      ri = this->lookup(REST_GET, "GET", req, res, route);
+    
+    return ri;
+  }
+  
+  int lookup(RESTMETHOD method, const char* name, Request* req, Response* res, RESTROUTE* route) {
+    RESTHANDLER* h;
+    
+    route->request_callback = NULL;
+    route->flags = 0;
+    
+    if (this->_routes != NULL)
+      return (this->_idx != NULL) ?
+        (findidx_P(this->_idx, this->_routes, method, req, res, route)) :
+        (findroute(this->_routes, this->_routesz, method, req, res, route));
+    
+    h = (this->_idx != NULL) ?
+      (findidx(this->_idx, this->_hdlr, name, req, res)) :
+      (findhdlr(this->_hdlr, this->_hdlrsz, name, req, res));
+    
+    if (h == NULL)
+      return -1;
+    
+    route->request_callback = h->request_callback;
+    route->flags = h->flags;
+    return h - this->_hdlr;
+  }
+  
+  // Method outside RESTMETHOD is implemented when a handler is registered with its name
+  bool implemented(const char* method) const {
+    for (int i = 0;i < this->_hdlrsz;++i) {
+      if (!strcmp(this->_hdlr[i].method, method))
+        return true;
+    }
+    
+    return false;
+  }
+  
+  // Bit mask of methods having handler for URL of request
+  // Bit of REST_UNKNOWN tells a handler of method outside RESTMETHOD matches
+  unsigned int allowed(Request* req) {
+    unsigned int mask = 0;
+    
+    for (int i = 0;i < this->_routesz;++i) {
+      if (urlmatch_P((const char PROGMEM*)pgm_read_ptr(&this->_routes[i].url), req->url()))
+        mask |= (1 << pgm_read_byte(&this->_routes[i].method));
+    }
+    
+    for (int i = 0;i < this->_hdlrsz;++i) {
+      if (urlmatch(this->_hdlr[i].url, req->url()))
+        mask |= (1 << _parsemethod(this->_hdlr[i].method));
+    }
+    
+    for (int i = 0;i < this->_assetsz;++i) {
+      if (!strcmp_P(req->url(), this->_assets[i].url))
+        mask |= (1 << REST_GET);
+    }
+    
+    return mask;
+  }
+  
+  // Answer OPTIONS or 405 with Allow header built from method mask
+  // Methods outside RESTMETHOD are listed by names of their handlers
+  void allow(Request* req, Response* res, unsigned int mask, const __FlashStringHelper* status) {
+    char value[72];
+    
+    value[0] = '\0';
+    mask |= (1 << REST_OPTIONS) | ((mask & (1 << REST_GET)) ? (1 << REST_HEAD) : (0));
+    
+    for (int m = REST_GET;m <= REST_PATCH;++m) {
+      if (!(mask & (1 << m)))
+        continue;
+      if (value[0] != '\0')
+        strcat_P(value, PSTR(", "));
+      strcat_P(value, (const char PROGMEM*)_methodname((RESTMETHOD)m));
+    }
+    
+    for (int i = 0;i < this->_hdlrsz && (mask & (1 << REST_UNKNOWN));++i) {
+      const char* name = this->_hdlr[i].method;
+      bool listed = false;
       
-      if(format[i] == '\0' || url[j] == '\0')
-        break;
+      if (_parsemethod(name) != REST_UNKNOWN || !urlmatch(this->_hdlr[i].url, req->url()))
+        continue;
+      for (int j = 0;j < i && !listed;++j)
+        listed = !strcmp(this->_hdlr[j].method, name) && urlmatch(this->_hdlr[j].url, req->url());
+      if (listed || strlen(value) + 2 + strlen(name) >= sizeof(value))
+        continue;
       
-      ++i; ++j;
+      strcat_P(value, PSTR(", "));
+      strcat(value, name);
     }
     
-    return !(strlen(&format[i]) + strlen(&url[j]));
+    res->status(status);
+    res->header()->set(F("Allow"), value);
   }
   
-  static RESTHANDLER* findhdlr(RESTHANDLER* handler, int len, Request* req, Response* res) {
-    for (int i = 0;i < len;++i) {
-      RESTHANDLER* h = &(handler[i]);
+  // Cache key is URL followed by query
+  static bool cachekey(const char* key, int keysz, Request* req) {
+    int urlsz = strlen(req->url());
+    int querysz = (req->query() != NULL) ? (strlen(req->query())) : (0);
+    
+    if (keysz != urlsz + ((querysz > 0) ? (querysz + 1) : (0)))
+      return false;
+    if (strncmp(key, req->url(), urlsz))
+      return false;
+    
+    return (querysz == 0) || (key[urlsz] == '?' && !strncmp(&key[urlsz + 1], req->query(), querysz));
+  }
+  
+  // Returns offset of cached entry for request, -1 if it is not cached
+  int cachefind(Request* req, RESTCACHEENTRY* e) const {
+    int i = 0;
+    
+    while (i < this->_cachepos) {
+      memcpy(e, &this->_cache[i], sizeof(RESTCACHEENTRY));
+      if (e->version == this->_cachever && cachekey(&this->_cache[i + sizeof(RESTCACHEENTRY)], e->keysz, req))
+        return i;
+      i += sizeof(RESTCACHEENTRY) + e->keysz + e->hdrsz + e->bodysz;
+    }
+    
+    return -1;
+  }
+  
+  // Copy 200 response into cache, whole cache is dropped when it is full
+  int cachestore(Request* req, Response* res, RESTCACHEENTRY* e) {
+    const char* hdr = (res->header() != NULL && res->header()->transmissible()) ? (res->header()->str()) : ("");
+    int urlsz = strlen(req->url());
+    int querysz = (req->query() != NULL) ? (strlen(req->query())) : (0);
+    long bodysz = bodylength(res);
+    long n;
+    char* p;
+    
+    e->keysz = urlsz + ((querysz > 0) ? (querysz + 1) : (0));
+    e->hdrsz = strlen(hdr);
+    e->bodysz = bodysz;
+    n = sizeof(RESTCACHEENTRY) + e->keysz + e->hdrsz + bodysz;
+    
+    if (this->_cache == NULL || n > this->_cachesz || bodysz > 0xFFFF)
+      return -1;
+    if (this->_cachepos + n > this->_cachesz)
+      this->_cachepos = 0;
+    
+    p = &this->_cache[this->_cachepos + sizeof(RESTCACHEENTRY)];
+    memcpy(p, req->url(), urlsz);
+    if (querysz > 0) {
+      p[urlsz] = '?';
+      memcpy(&p[urlsz + 1], req->query(), querysz);
+    }
+    p += e->keysz;
+    memcpy(p, hdr, e->hdrsz);
+    p += e->hdrsz;
+    if (res->use_constbody())
+      memcpy_P(p, (const char PROGMEM*)res->constbody(), bodysz);
+    else if (res->use_writer())
+      memcpy(p, res->writer()->str(), bodysz);
+    else
+      memcpy(p, res->body().c_str(), bodysz);
+    
+    // Cache version seeds hash, so tags of same body differ across invalidations
+    e->version = this->_cachever;
+    e->etag = _fnv1a(p, bodysz, 2166136261UL ^ e->version);
+    
+    memcpy(&this->_cache[this->_cachepos], e, sizeof(RESTCACHEENTRY));
+    this->_cachepos += n;
+    return this->_cachepos - n;
+  }
+  
+  // Quoted ETag of 8 hex digits
+  static void etag(unsigned long h, char* tag) {
+    tag[0] = '"';
+    for (int i = 0;i < 8;++i)
+      tag[8 - i] = "0123456789abcdef"[(h >> (i * 4)) & 0x0F];
+    tag[9] = '"';
+    tag[10] = '\0';
+  }
+  
+  static bool notmodified(Request* req, const char* tag) {
+    RESTVIEW v = req->header()->get_view(F("If-None-Match"));
+    
+    if (v.len == 1 && v.str[0] == '*')
+      return true;
+    for (int i = 0;i + 10 <= v.len;++i) {
+      if (!strncmp(&v.str[i], tag, 10))
+        return true;
+    }
+    
+    return false;
+  }
+  
+  // Client already has entry at, when If-None-Match of request names its tag
+  bool cachefresh(Request* req, int at) const {
+    RESTCACHEENTRY e;
+    char tag[11];
+    
+    memcpy(&e, &this->_cache[at], sizeof(RESTCACHEENTRY));
+    etag(e.etag, tag);
+    return notmodified(req, tag);
+  }
+  
+  // Send cached entry, or header only 304 if client has the same one
+  // Only method of request is used, its header may be overwritten by transmission
+  bool cachesend(Transmitter* tx, Request* req, int at, bool fresh, bool persist) const {
+    RESTCACHEENTRY e;
+    const char* p = &this->_cache[at + sizeof(RESTCACHEENTRY)];
+    bool head = (req->method_id() == REST_HEAD);
+    char tag[11];
+    
+    memcpy(&e, &this->_cache[at], sizeof(RESTCACHEENTRY));
+    etag(e.etag, tag);
+    p += e.keysz;
+    
+    if (fresh) {
+      tx->print(HTTP_304_NOT_MODIFIED);
+      head = true;
+    } else {
+      tx->print(HTTP_200_OK);
+      tx->write(p, e.hdrsz);
+      tx->print(F("Content-Length: "));
+      tx->print((unsigned long)e.bodysz);
+      tx->print(HTTP_END_OF_REQUEST);
+    }
+    
+    tx->print(F("ETag: "));
+    tx->print(tag);
+    tx->print(HTTP_END_OF_REQUEST);
+    tx->print(F("Connection: "));
+    tx->print((persist) ? (F("keep-alive\r\n")) : (F("close\r\n")));
+    tx->print(HTTP_END_OF_REQUEST);
+    
+    if (!head)
+      tx->write(p + e.hdrsz, e.bodysz);
+    tx->flush();
+    return persist;
+  }
+  
+  const RESTASSET* findasset(Request* req, Response* res, bool* gz) {
+    for (int i = 0;i < this->_assetsz;++i) {
+      const RESTASSET* a = &(this->_assets[i]);
       
-      if ((!strcmp(h->method, req->method())) && urlmatch(h->url, req->url())) {
+      if (!strcmp_P(req->url(), a->url)) {
+        RESTVIEW v = req->header()->get_view(F("Accept-Encoding"));
+        
+        // Encoding is chosen before request buffer is reused for transmission
+        *gz = (pgm_read_ptr(&a->gzdata) != NULL) && (_strfind_P(v.str, v.len, PSTR("gzip")) >= 0);
         res->status(HTTP_200_OK);
-        req->url_format(h->url);
-        return h;
+        return a;
       }
     }
     
     return NULL;
   }
   
-public:
-  int buffer_size() const {
-    return this->_bufsz;
+  static bool assetsend(Transmitter* tx, Request* req, Response* res, const RESTASSET* a, bool gz, bool persist) {
+    const char PROGMEM* data = (const char PROGMEM*)pgm_read_ptr((gz) ? (&a->gzdata) : (&a->data));
+    unsigned long length;
+    
+    memcpy_P(&length, (gz) ? (&a->gzlength) : (&a->length), sizeof(length));
+    
+    tx->print(res->status());
+    tx->print(F("Content-Type: "));
+    tx->write_P(a->content_type, strlen_P(a->content_type));
+    tx->print(HTTP_END_OF_REQUEST);
+    tx->print(F("Cache-Control: " RESTFUL_ASSET_CACHE_CONTROL "\r\n"));
+    if (pgm_read_ptr(&a->gzdata) != NULL)
+      tx->print(F("Vary: Accept-Encoding\r\n"));
+    if (gz)
+      tx->print(F("Content-Encoding: gzip\r\n"));
+    tx->print(F("Content-Length: "));
+    tx->print(length);
+    tx->print(HTTP_END_OF_REQUEST);
+    tx->print(F("Connection: "));
+    tx->print((persist) ? (F("keep-alive\r\n")) : (F("close\r\n")));
+    tx->print(HTTP_END_OF_REQUEST);
+    
+    if (req->method_id() != REST_HEAD)
+      tx->write_P(data, length);
+    tx->flush();
+    return persist;
   }
   
-  int reserved_buffer_size() const {
-    return this->_rbufsz;
+  // Part received together with header is skipped in place, bytes behind it may be next request
+  // Rest of body is dropped by later steps of polled connection, large one is not worth it
+  // Returns false when connection has to be closed instead
+  static bool discard(Request* req, RESTCONNECTION* conn, bool polled) {
+    int m = (int)min((long)(req->_bodysz - req->_bodypos), req->_remaining);
+    
+    req->_bodypos += m;
+    req->_remaining -= m;
+    if (req->remaining() == 0)
+      return true;
+    if (!polled || req->remaining() > conn->bufsz)
+      return false;
+    
+    conn->skipsz = req->remaining();
+    return true;
   }
   
-  int timeout() const {
-    return this->_recvtimeout;
+  // Read unread body of previous request without waiting, its deadline is measured from response
+  // Returns 1 when it is dropped, 0 when more bytes are needed, -1 on timeout or disconnection
+  int drain(RESTCLIENT& client, RESTCONNECTION* conn) {
+    long n = client.available();
+    
+    n = min(n, min(conn->skipsz, (long)conn->bufsz));
+    if (n > 0) {
+      n = client.read((uint8_t*)conn->buf, (int)n);
+      if (n > 0)
+        conn->skipsz -= n;
+    }
+    
+    if (conn->skipsz == 0) {
+      nextconn(conn);
+      return 1;
+    }
+    
+    return (timeover(conn->begin, this->_bodytimeout) || !client.connected()) ? (-1) : (0);
   }
   
-  void timeout(int timeout) {
-    this->_recvtimeout = timeout;
+  // Bytes received after body are the start of next pipelined request
+  // Returns offset of transmission buffer, which begins right behind those bytes
+  static int pipeline(RESTCONNECTION* conn, Request* req, bool* persist, bool compact) {
+    int n = req->_bodysz - req->_bodypos;
+    int end = (int)(req->_body - conn->buf) + req->_bodysz;
+    
+    conn->nextsz = 0;
+    if (!*persist || req->remaining() > 0 || n <= 0)
+      return 0;
+    
+    // Response gets all room but pipelined bytes, request is overwritten from here on
+    if (compact) {
+      memmove(conn->buf, conn->buf + end - n, n);
+      end = n;
+    }
+    
+    // Too little room is left for response, so client has to send them again
+    if (conn->bufsz - end < RESTFUL_TRANSMIT_MIN_SIZE) {
+      *persist = false;
+      return 0;
+    }
+    
+    conn->nextpos = end - n;
+    conn->nextsz = n;
+    return end;
   }
-
-public:
-  RESTful(char* buf, int bufsz, int rbufsz, RESTHANDLER* handler, int hdlrsz) {
-    this->_rbufsz = rbufsz;
-    this->_bufsz = bufsz - rbufsz;
-    this->_rbuf = buf + this->_bufsz;
-    this->_buf = buf;
-    this->_hdlr = handler;
-    this->_hdlrsz = hdlrsz;
-    this->_recvtimeout = 7000;
+  
+  void reject(RESTCLIENT& client, RESTCONNECTION* conn, const __FlashStringHelper* status) {
+    Transmitter tx(&client, conn->buf, conn->bufsz);
+    sendhead(&tx, status, NULL, 0, false, false);
+    tx.flush();
+  }
+  
+  // Serve one request, returns whether connection can serve another one
+  bool serve(RESTCLIENT& client, bool persist) {
+    int presz = 0;
+    int r = this->recvall(&client, this->_recvtimeout, &this->_conn, &presz);
+    
+    // Upgraded connection is left open for WebSocket
+    if (r > 0)
+      return process(client, &this->_conn, presz, persist, false) && !this->_conn.detached;
+    
+#ifdef RESTFUL_METRICS
+    if (r < 0)
+      this->_metrics.overflows++;
+    else
+      this->_metrics.timeouts++;
+#endif
+    reject(client, &this->_conn, (r < 0) ? (overflowed(&this->_conn)) : (HTTP_408_REQUEST_TIME_OUT));
+    return false;
+  }
+  
+  int step(RESTCLIENT& client, RESTCONNECTION* conn) {
+    int presz = 0;
+    
+    if (conn->deferred != NULL)
+      return this->resume(client, conn);
+    
+    if (!conn->active) {
+      initconn(conn);
+      conn->active = true;
+    }
+    
+    // Body left unread by previous handler is dropped before next request
+    if (conn->skipsz > 0) {
+      int d = this->drain(client, conn);
+      
+      if (d == 0)
+        return RESTFUL_NEED_MORE;
+      if (d < 0) {
+        conn->active = false;
+        conn->nreq = 0;
+        client.stop();
+        return RESTFUL_CLOSED;
+      }
+    }
+    
+    int r = this->recvsome(&client, conn, &presz);
+    if (r == 0) {
+      bool idle = (conn->recvsz == 0);
+      int interval = (idle && conn->nreq > 0) ? (this->_katimeout) : (this->_recvtimeout);
+      
+      if (!timeover(conn->begin, interval) && client.connected())
+        return RESTFUL_NEED_MORE;
+      
+      // Nothing was received, so just close connection
+      if (idle) {
+        conn->active = false;
+        conn->nreq = 0;
+        client.stop();
+        return RESTFUL_CLOSED;
+      }
+      
+#ifdef RESTFUL_METRICS
+      this->_metrics.timeouts++;
+#endif
+      r = -2;
+    }
+    
+    conn->active = false;
+    if (r < 0) {
+#ifdef RESTFUL_METRICS
+      if (r == -1)
+        this->_metrics.overflows++;
+#endif
+      reject(client, conn, (r == -1) ? (overflowed(conn)) : (HTTP_408_REQUEST_TIME_OUT));
+      conn->nreq = 0;
+      client.stop();
+      return RESTFUL_ERROR;
+    }
+    
+    // Idle time of persistent connection is measured from here
+    if (process(client, conn, presz, ++conn->nreq < this->_kamax, true)) {
+      // Parked connection is kept until handler completes
+      conn->active = true;
+      if (conn->deferred != NULL)
+        return RESTFUL_NEED_MORE;
+      
+      nextconn(conn);
+      return RESTFUL_DISPATCHED;
+    }
+    
+    conn->nreq = 0;
+    if (conn->detached)
+      return RESTFUL_UPGRADED;
+    client.stop();
+    return RESTFUL_DISPATCHED;
   }
   
 public:
-  void loop(EthernetClient& client) {
-    // Receive request
-    memset(this->_buf, 0x00, this->_bufsz + this->_rbufsz);
-    if (recvall(&client, this->_recvtimeout, this->_buf, this->_bufsz)) {
-        Header ihdr;
-        Header ohdr;
-        Request req(&ihdr);
-        Response res(&ohdr);
-        
-        // Build request and response object
-        buildreq(this->_buf, this->_bufsz, this->_rbufsz, &req, &res);
-        
-        // Check request is valid
-        if (!req.failed()) {
-          // Search request handler
-          RESTHANDLER* hdlr = findhdlr(this->_hdlr, this->_hdlrsz, &req, &res);
-          
-          // Process request
-          if (hdlr != NULL)
-            hdlr->request_callback(&req, &res, &client);
-          
-          // Send response and header fields
-          client.print(res.status());
-          if (ohdr.transmissible())
-            client.print(ohdr.str());
-          client.print(HTTP_END_OF_REQUEST);
-          
-          // Send response body
-          if (res.use_constbody())
-            client.print(res.constbody());
-          else
-            client.print(res.body());
-          return;
-        }
+  // Serve requests of client until its connection ends
+  // Client is kept open for WebSocket or event stream when RESTFUL_UPGRADED is returned, so it must not be stopped
+  // Otherwise RESTFUL_DISPATCHED is returned
+  int loop(RESTCLIENT& client) {
+    this->_conn.nextsz = 0;
+    this->_conn.detached = false;
+    for (int n = 1;serve(client, n < this->_kamax);++n) {
+      unsigned long ts = millis();
+      
+      // Wait for next request on persistent connection unless it is already pipelined
+      while (!client.available() && this->_conn.nextsz == 0) {
+        if (timeover(ts, this->_katimeout) || !client.connected())
+          return RESTFUL_DISPATCHED;
+      }
+    }
+    
+    return (this->_conn.detached) ? (RESTFUL_UPGRADED) : (RESTFUL_DISPATCHED);
+  }
+  
+  // Consume available bytes of client and return immediately
+  // Client is stopped by RESTful when RESTFUL_ERROR or RESTFUL_CLOSED is returned
+  // Client is kept open for WebSocket or event stream when RESTFUL_UPGRADED is returned
+  // One client is served at a time, so another one polled while a request is in progress
+  // gets RESTFUL_NEED_MORE and its bytes are left unread; connections, accept and service serve several
+  int poll(RESTCLIENT& client) {
+    RESTCONNECTION* conn = &this->_conn;
+    
+    if (conn->active && !(conn->client == client)) {
+      // Request in progress is stepped, so it is answered or times out even if its client is not polled
+      if (conn->recvsz > 0 || conn->skipsz > 0 || conn->deferred != NULL) {
+        this->step(conn->client, conn);
+        if (conn->active && (conn->recvsz > 0 || conn->skipsz > 0 || conn->deferred != NULL))
+          return RESTFUL_NEED_MORE;
+      }
+      
+      // Idle persistent connection is left to its client
+      conn->active = false;
+      conn->nreq = 0;
+    }
+    
+    conn->client = client;
+    return this->step(client, conn);
+  }
+  
+  // Split buffer into connections for accept and service
+  void connections(RESTCONNECTION* conn, int connsz) {
+    int slicesz = (connsz > 0) ? (this->_bufsz / connsz) : (0);
+    
+    for (int i = 0;i < connsz;++i) {
+      conn[i].used = false;
+      conn[i].active = false;
+      conn[i].nreq = 0;
+      conn[i].deferred = NULL;
+      conn[i].nextsz = 0;
+      conn[i].skipsz = 0;
+      conn[i].buf = this->_buf + (i * slicesz);
+      conn[i].bufsz = slicesz;
+    }
+    
+    this->_pool = conn;
+    this->_poolsz = connsz;
+    this->_rr = 0;
+  }
+  
+  // Attach client to free connection, returns false when all connections are in use
+  bool accept(RESTCLIENT& client) {
+    return (this->attach(client) >= 0);
+  }
+  
+  // Attach client and return its slot for service(slot), -1 when all connections are in use
+  int attach(RESTCLIENT& client) {
+    int slot = -1;
+    
+    for (int i = 0;i < this->_poolsz;++i) {
+      if (!this->_pool[i].used)
+        slot = (slot == -1) ? (i) : (slot);
+      else if (this->_pool[i].client == client)
+        return i;
+    }
+    
+    if (slot == -1)
+      return -1;
+    
+    this->_pool[slot].client = client;
+    this->_pool[slot].used = true;
+    this->_pool[slot].active = false;
+    this->_pool[slot].nreq = 0;
+    this->_pool[slot].deferred = NULL;
+    this->_pool[slot].nextsz = 0;
+    this->_pool[slot].skipsz = 0;
+    return slot;
+  }
+  
+  // Step every attached connection once in round-robin order
+  void service() {
+    for (int i = 0;i < this->_poolsz;++i) {
+      // One request per connection in each pass, pipelined ones wait for next pass
+      this->service((this->_rr + i) % this->_poolsz);
+    }
+    
+    if (this->_poolsz > 0)
+      this->_rr = (this->_rr + 1) % this->_poolsz;
+  }
+  
+  // Step connection of slot reported ready by event loop, such as epoll of PosixServer
+  // Returns result of step, RESTFUL_CLOSED when slot is not in use
+  int service(int slot) {
+    if (slot < 0 || slot >= this->_poolsz || !this->_pool[slot].used)
+      return RESTFUL_CLOSED;
+    
+    RESTCONNECTION* conn = &this->_pool[slot];
+    int r = step(conn->client, conn);
+    if (r == RESTFUL_ERROR || r == RESTFUL_CLOSED || !conn->active)
+      conn->used = false;
+    return r;
+  }
+  
+  // Step connections having work without new input, when only ready slots are serviced
+  // Those are new, parked, holding pipelined bytes or past deadline
+  void sweep() {
+    for (int i = 0;i < this->_poolsz;++i) {
+      RESTCONNECTION* conn = &this->_pool[i];
+      int interval;
+      
+      if (!conn->used)
+        continue;
+      
+      if (conn->skipsz > 0)
+        interval = this->_bodytimeout;
+      else if (conn->recvsz == 0 && conn->nreq > 0)
+        interval = this->_katimeout;
+      else
+        interval = this->_recvtimeout;
+      
+      if (!conn->active || conn->deferred != NULL || conn->scansz < conn->recvsz || timeover(conn->begin, interval))
+        this->service(i);
     }
-    client.print(HTTP_400_BAD_REQUEST);
-    client.print(HTTP_END_OF_REQUEST);
   }
 };
-
@@ -0,0 +1,433 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <string>
+
+/*
+ * POSIX transport
+ * 
+ * Subset of Arduino API used by RESTful and non-blocking socket client,
+ * so same handlers can run on Linux host. Define RESTFUL_POSIX before including RESTful.h.
+ */
+// Another client such as mock of tests can be given by defining RESTFUL_CLIENT before
+#ifndef RESTFUL_CLIENT
+#define RESTFUL_CLIENT                            PosixClient
+#endif
+// Total time a response write may wait for slow reader before its socket is shut down
+#ifndef RESTFUL_POSIX_WRITE_TIMEOUT
+#define RESTFUL_POSIX_WRITE_TIMEOUT               100
+#endif
+
+using std::min;
+using std::max;
+
+// Flash memory is ordinary memory on host
+class __FlashStringHelper;
+#define PROGMEM
+#define PSTR(s)                                   (s)
+#define F(s)                                      (reinterpret_cast<const __FlashStringHelper*>(PSTR(s)))
+#define pgm_read_byte(p)                          (*(const unsigned char*)(p))
+#define pgm_read_ptr(p)                           (*(void* const*)(p))
+#define memcpy_P                                  memcpy
+#define strlen_P                                  strlen
+#define strcmp_P                                  strcmp
+#define strncmp_P                                 strncmp
+#define strncasecmp_P                             strncasecmp
+#define strcat_P                                  strcat
+#define strcpy_P                                  strcpy
+
+inline unsigned long millis() {
+  struct timespec ts;
+  
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long)(ts.tv_sec * 1000UL + ts.tv_nsec / 1000000UL);
+}
+
+
+class String {
+private:
+  std::string _s;
+  
+public:
+  String() {
+  }
+  
+  String(const char* s) : _s((s != NULL) ? (s) : ("")) {
+  }
+  
+  String(const __FlashStringHelper* s) : _s((s != NULL) ? ((const char*)s) : ("")) {
+  }
+  
+  String(long v) : _s(std::to_string(v)) {
+  }
+  
+  unsigned int length() const {
+    return this->_s.size();
+  }
+  
+  const char* c_str() const {
+    return this->_s.c_str();
+  }
+  
+  void reserve(unsigned int n) {
+    this->_s.reserve(n);
+  }
+  
+  char operator[](unsigned int i) const {
+    return this->_s[i];
+  }
+  
+  String& operator+=(char c) {
+    this->_s += c;
+    return *this;
+  }
+  
+  String& operator+=(const char* s) {
+    this->_s += s;
+    return *this;
+  }
+  
+  String& operator+=(const String& s) {
+    this->_s += s._s;
+    return *this;
+  }
+  
+  bool operator==(const char* s) const {
+    return this->_s == s;
+  }
+  
+  friend String operator+(const String& s, const String& ss) {
+    String r = s;
+    r += ss;
+    return r;
+  }
+};
+
+
+class Print {
+public:
+  virtual ~Print() {
+  }
+  
+  virtual size_t write(uint8_t c) = 0;
+  
+  virtual size_t write(const uint8_t* s, size_t n) {
+    size_t i = 0;
+    
+    while (i < n && this->write(s[i]))
+      ++i;
+    
+    return i;
+  }
+  
+  size_t write(const char* s) {
+    return this->write((const uint8_t*)s, strlen(s));
+  }
+  
+  size_t print(const char* s) {
+    return this->write(s);
+  }
+  
+  size_t print(const String& s) {
+    return this->write(s.c_str());
+  }
+  
+  size_t print(const __FlashStringHelper* s) {
+    return this->write((const char*)s);
+  }
+  
+  size_t print(char c) {
+    return this->write((uint8_t)c);
+  }
+  
+  size_t print(int v) {
+    return this->print((long)v);
+  }
+  
+  size_t print(unsigned int v) {
+    return this->print((unsigned long)v);
+  }
+  
+  // Digits are made by division as Arduino Print does, not by snprintf
+  size_t print(long v) {
+    if (v >= 0)
+      return this->print((unsigned long)v);
+    
+    return this->print('-') + this->print(0UL - (unsigned long)v);
+  }
+  
+  size_t print(unsigned long v) {
+    char num[24];
+    int i = sizeof(num);
+    
+    do {
+      num[--i] = '0' + (v % 10);
+      v /= 10;
+    } while (v != 0);
+    
+    return this->write((const uint8_t*)&num[i], sizeof(num) - i);
+  }
+  
+  size_t print(double v, int digits = 2) {
+    char num[48];
+    
+    snprintf(num, sizeof(num), "%.*f", digits, v);
+    return this->write(num);
+  }
+  
+  size_t println() {
+    return this->write("\r\n");
+  }
+};
+
+
+/*
+ * Socket client
+ * 
+ * Non-blocking socket with the interface of EthernetClient used by RESTful.
+ * Copies share socket, stop closes it.
+ */
+class PosixClient : public Print {
+private:
+  int _fd;
+  
+public:
+  PosixClient(int fd = -1) {
+    this->_fd = fd;
+  }
+  
+  int fd() const {
+    return this->_fd;
+  }
+  
+  int available() {
+    int n = 0;
+    
+    if (this->_fd < 0 || ioctl(this->_fd, FIONREAD, &n) < 0)
+      return 0;
+    
+    return n;
+  }
+  
+  int read(uint8_t* buf, size_t n) {
+    ssize_t r = (this->_fd >= 0) ? (recv(this->_fd, buf, n, 0)) : (-1);
+    return (r > 0) ? ((int)r) : (-1);
+  }
+  
+  int read() {
+    uint8_t c;
+    return (this->read(&c, 1) == 1) ? (c) : (-1);
+  }
+  
+  virtual size_t write(uint8_t c) {
+    return this->write(&c, 1);
+  }
+  
+  // Socket is non-blocking, so wait until it is writable when send buffer is full
+  // Whole write waits RESTFUL_POSIX_WRITE_TIMEOUT at most, then peer is cut off,
+  // so one slow reader can not stall other connections of the pool
+  virtual size_t write(const uint8_t* s, size_t n) {
+    size_t sent = 0;
+    unsigned long ts = millis();
+    
+    while (this->_fd >= 0 && sent < n) {
+      ssize_t r = send(this->_fd, s + sent, n - sent, MSG_NOSIGNAL);
+      
+      if (r > 0) {
+        sent += r;
+      } else if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        struct pollfd p = { this->_fd, POLLOUT, 0 };
+        long left = RESTFUL_POSIX_WRITE_TIMEOUT - (long)(millis() - ts);
+        
+        if (left <= 0 || ::poll(&p, 1, left) <= 0) {
+          shutdown(this->_fd, SHUT_RDWR);
+          break;
+        }
+      } else if (r < 0 && errno != EINTR) {
+        break;
+      }
+    }
+    
+    return sent;
+  }
+  
+  using Print::write;
+  
+  // Peer is connected until orderly shutdown or error is seen
+  uint8_t connected() {
+    char c;
+    ssize_t r;
+    
+    if (this->_fd < 0)
+      return 0;
+    
+    r = recv(this->_fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return (r > 0) || (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR));
+  }
+  
+  void stop() {
+    if (this->_fd >= 0)
+      close(this->_fd);
+    this->_fd = -1;
+  }
+  
+  void flush() {
+  }
+  
+  operator bool() const {
+    return (this->_fd >= 0);
+  }
+  
+  bool operator==(const PosixClient& client) const {
+    return (this->_fd == client._fd);
+  }
+};
+
+
+/*
+ * Socket server
+ * 
+ * Listening socket and epoll set of accepted clients.
+ * wait blocks until a client is readable or new client is accepted.
+ * Client watched with its slot of RESTful is reported by slot, so only ready connections are stepped.
+ * 
+ * PosixServer server(8080);
+ * server.begin();
+ * while (true) {
+ *   PosixClient client;
+ *   server.wait(100);
+ *   while (server.accept(client)) {
+ *     int slot = rest.attach(client);
+ *     if (slot < 0) client.stop(); else server.watch(client, slot);
+ *   }
+ *   for (int i = 0;i < server.ready();++i)
+ *     rest.service(server.slot(i));
+ *   rest.sweep();
+ * }
+ */
+#define RESTFUL_POSIX_EVENTS                      64
+
+class PosixServer {
+private:
+  int _port;
+  int _fd;
+  int _epfd;
+  bool _pending;
+  int _ready[RESTFUL_POSIX_EVENTS];
+  int _readysz;
+  
+public:
+  PosixServer(int port) {
+    this->_port = port;
+    this->_fd = -1;
+    this->_epfd = -1;
+    this->_pending = false;
+    this->_readysz = 0;
+  }
+  
+  ~PosixServer() {
+    if (this->_fd >= 0)
+      close(this->_fd);
+    if (this->_epfd >= 0)
+      close(this->_epfd);
+  }
+  
+  bool begin(int backlog = 1024) {
+    struct sockaddr_in addr;
+    struct epoll_event ev;
+    int on = 1;
+    
+    memset(&addr, 0x00, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(this->_port);
+    
+    this->_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    this->_epfd = epoll_create1(0);
+    if (this->_fd < 0 || this->_epfd < 0)
+      return false;
+    
+    setsockopt(this->_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(this->_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(this->_fd, backlog) < 0)
+      return false;
+    
+    ev.events = EPOLLIN;
+    ev.data.u64 = (uint64_t)this->_fd;
+    return (epoll_ctl(this->_epfd, EPOLL_CTL_ADD, this->_fd, &ev) == 0);
+  }
+  
+  // Returns number of ready sockets, 0 on timeout
+  // Closed sockets leave epoll set by themselves
+  int wait(int timeout) {
+    struct epoll_event ev[RESTFUL_POSIX_EVENTS];
+    int n = epoll_wait(this->_epfd, ev, RESTFUL_POSIX_EVENTS, timeout);
+    
+    // Upper half of data is slot plus one given by watch
+    this->_readysz = 0;
+    for (int i = 0;i < n;++i) {
+      if (ev[i].data.u64 == (uint64_t)this->_fd)
+        this->_pending = true;
+      else if ((ev[i].data.u64 >> 32) > 0)
+        this->_ready[this->_readysz++] = (int)(ev[i].data.u64 >> 32) - 1;
+    }
+    
+    return (n > 0) ? (n) : (0);
+  }
+  
+  // Number of watched clients found ready by last wait
+  int ready() const {
+    return this->_readysz;
+  }
+  
+  int slot(int i) const {
+    return this->_ready[i];
+  }
+  
+  // Report readiness of client by its slot from now on
+  bool watch(const PosixClient& client, int slot) {
+    struct epoll_event ev;
+    
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.u64 = (uint64_t)client.fd() | ((uint64_t)(slot + 1) << 32);
+    return (epoll_ctl(this->_epfd, EPOLL_CTL_MOD, client.fd(), &ev) == 0);
+  }
+  
+  // Accept one pending client, returns false when there is none
+  bool accept(PosixClient& client) {
+    struct epoll_event ev;
+    int on = 1;
+    int fd;
+    
+    if (!this->_pending)
+      return false;
+    
+    fd = accept4(this->_fd, NULL, NULL, SOCK_NONBLOCK);
+    if (fd < 0) {
+      this->_pending = false;
+      return false;
+    }
+    
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.u64 = (uint64_t)fd;
+    epoll_ctl(this->_epfd, EPOLL_CTL_ADD, fd, &ev);
+    
+    client = PosixClient(fd);
+    return true;
+  }
+};
@@ -1,12 +1,19 @@
 #pragma once
+#if defined(RESTFUL_POSIX)
+#include "rfposix.h"
+#else
 #include <Arduino.h>
+#endif
+#if defined(__AVR__)
 #include <avr/pgmspace.h>
+#endif
+#include <limits.h>
 
-bool inline timeover(unsigned long ts, unsigned long interval) {
+inline bool timeover(unsigned long ts, unsigned long interval) {
   return (((unsigned long)(millis() - ts)) >= interval);
 }
 
-bool _strcmp(const char* s, const char* ss, const char eos) {
+inline bool _strcmp(const char* s, const char* ss, const char eos) {
   while((*s != '\0' && *s != eos) && (*ss != '\0' && *ss != eos)) {
     if(*(s++) != *(ss++))
       return false;
@@ -14,7 +21,26 @@ bool _strcmp(const char* s, const char* ss, const char eos) {
   return (*s == '\0' || *s == eos) && (*ss == '\0' || *ss == eos);
 }
 
-int _struntil(const char* s, const char eos) {
+inline unsigned char _strhash(const char* s, int n) {
+  unsigned char h = 0;
+  
+  for (int i = 0;i < n;++i)
+    h = (h * 31) + tolower(s[i]);
+  
+  return h;
+}
+
+inline unsigned char _strhash_P(const __FlashStringHelper* s, int n) {
+  const char PROGMEM* ps = (const char PROGMEM*)s;
+  unsigned char h = 0;
+  
+  for (int i = 0;i < n;++i)
+    h = (h * 31) + tolower(pgm_read_byte(&(ps[i])));
+  
+  return h;
+}
+
+inline int _struntil(const char* s, const char eos) {
   const char *sbegin = s;
   
   while(*(s) != '\0' && *(s) != eos)
@@ -23,7 +49,7 @@ int _struntil(const char* s, const char eos) {
   return (s - sbegin);
 }
 
-bool _strcmp_P(const __FlashStringHelper* s, const __FlashStringHelper* ss, const char eos) {
+inline bool _strcmp_P(const __FlashStringHelper* s, const __FlashStringHelper* ss, const char eos) {
   const char PROGMEM* ps = (const char PROGMEM*)s;
   const char PROGMEM* pss = (const char PROGMEM*)ss;
   int i = 0;
@@ -42,7 +68,7 @@ bool _strcmp_P(const __FlashStringHelper* s, const __FlashStringHelper* ss, cons
   return (sc == '\0' || sc == eos) && (ssc == '\0' || ssc == eos);
 }
 
-bool _strcmp_P(const __FlashStringHelper* s, const char* ss, const char eos) {
+inline bool _strcmp_P(const __FlashStringHelper* s, const char* ss, const char eos) {
   const char PROGMEM* ps = (const char PROGMEM*)s;
   int i = 0;
   int j = 0;
@@ -60,7 +86,7 @@ bool _strcmp_P(const __FlashStringHelper* s, const char* ss, const char eos) {
   return (sc == '\0' || sc == eos) && (ssc == '\0' || ssc == eos);
 }
 
-bool _strcmp_P(const char* s, const __FlashStringHelper* ss, const char eos) {
+inline bool _strcmp_P(const char* s, const __FlashStringHelper* ss, const char eos) {
   const char PROGMEM* pss = (const char PROGMEM*)ss;
   int i = 0;
   int j = 0;
@@ -78,7 +104,7 @@ bool _strcmp_P(const char* s, const __FlashStringHelper* ss, const char eos) {
   return (sc == '\0' || sc == eos) && (ssc == '\0' || ssc == eos);
 }
 
-int _struntil_P(const __FlashStringHelper* s, const char eos) {
+inline int _struntil_P(const __FlashStringHelper* s, const char eos) {
   int cnt = 0;
   const char PROGMEM* ps = (const char PROGMEM*)s;
   char c = pgm_read_byte(&(ps[cnt]));
@@ -88,3 +114,198 @@ int _struntil_P(const __FlashStringHelper* s, const char eos) {
     
   return cnt;
 }
+
+// Parse decimal integer of n characters, def is returned if it is empty, invalid or out of range of long
+inline long _strtol(const char* s, int n, long def) {
+  int i = 0;
+  long v = 0;
+  int d;
+  bool neg = false;
+  
+  if (s == NULL || n <= 0)
+    return def;
+  
+  if (s[0] == '-' || s[0] == '+')
+    neg = (s[i++] == '-');
+  
+  if (i >= n)
+    return def;
+  
+  for (;i < n;++i) {
+    if (s[i] < '0' || s[i] > '9')
+      return def;
+    
+    d = s[i] - '0';
+    if (v > (LONG_MAX - d) / 10)
+      return def;
+    v = (v * 10) + d;
+  }
+  
+  return (neg) ? (-v) : (v);
+}
+
+// Parse decimal fraction of n characters, def is returned if it is empty or invalid
+inline float _strtof(const char* s, int n, float def) {
+  int i = 0;
+  int digits = 0;
+  float v = 0.0f;
+  float scale = 1.0f;
+  bool neg = false;
+  bool frac = false;
+  
+  if (s == NULL || n <= 0)
+    return def;
+  
+  if (s[0] == '-' || s[0] == '+')
+    neg = (s[i++] == '-');
+  
+  for (;i < n;++i) {
+    if (s[i] == '.' && !frac) {
+      frac = true;
+      continue;
+    }
+    
+    if (s[i] < '0' || s[i] > '9')
+      return def;
+    
+    v = (v * 10.0f) + (s[i] - '0');
+    if (frac)
+      scale *= 10.0f;
+    ++digits;
+  }
+  
+  if (digits == 0)
+    return def;
+  
+  return ((neg) ? (-v) : (v)) / scale;
+}
+
+inline int _hexval(const char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+// Decode percent-encoding of n characters in place, returns decoded length
+// '+' is decoded to space only in form (query) encoding
+inline int _urldecode(char* s, int n, bool form) {
+  int j = 0;
+  
+  for (int i = 0;i < n;++i, ++j) {
+    if (s[i] == '%' && i + 2 < n && _hexval(s[i + 1]) >= 0 && _hexval(s[i + 2]) >= 0) {
+      s[j] = (char)((_hexval(s[i + 1]) << 4) | _hexval(s[i + 2]));
+      i += 2;
+    } else {
+      s[j] = (form && s[i] == '+') ? (' ') : (s[i]);
+    }
+  }
+  
+  return j;
+}
+
+// 32-bit FNV-1a hash of n bytes continued from h
+inline unsigned long _fnv1a(const char* s, int n, unsigned long h) {
+  for (int i = 0;i < n;++i) {
+    h ^= (unsigned char)s[i];
+    h *= 16777619UL;
+  }
+  
+  return h & 0xFFFFFFFFUL;
+}
+
+// Offset of PROGMEM string in first n characters of s ignoring case, -1 if not found
+inline int _strfind_P(const char* s, int n, const char PROGMEM* ss) {
+  int m = strlen_P(ss);
+  
+  for (int i = 0;i + m <= n;++i) {
+    if (!strncasecmp_P(&s[i], ss, m))
+      return i;
+  }
+  
+  return -1;
+}
+
+inline uint32_t _rol32(uint32_t v, int n) {
+  return (v << n) | (v >> (32 - n));
+}
+
+// SHA-1 digest of n bytes, message schedule is kept in 16 words to save SRAM
+inline void _sha1(const char* s, int n, unsigned char* digest) {
+  uint32_t h[5] = { 0x67452301UL, 0xEFCDAB89UL, 0x98BADCFEUL, 0x10325476UL, 0xC3D2E1F0UL };
+  uint32_t w[16];
+  int blocks = (n + 8) / 64 + 1;
+  
+  for (int b = 0;b < blocks;++b) {
+    uint32_t a = h[0], bb = h[1], c = h[2], d = h[3], e = h[4];
+    
+    for (int j = 0;j < 64;++j) {
+      long i = (long)b * 64 + j;
+      unsigned char x = (i < n) ? ((unsigned char)s[i]) : ((i == n) ? (0x80) : (0x00));
+      
+      // Bit length is placed at the end of last block
+      if (b == blocks - 1 && j >= 56)
+        x = (j < 60) ? (0x00) : ((unsigned char)(((uint32_t)n << 3) >> ((63 - j) * 8)));
+      w[j / 4] = (j % 4 == 0) ? ((uint32_t)x << 24) : (w[j / 4] | ((uint32_t)x << ((3 - j % 4) * 8)));
+    }
+    
+    for (int t = 0;t < 80;++t) {
+      uint32_t f, k, tmp;
+      
+      if (t >= 16)
+        w[t & 15] = _rol32(w[(t + 13) & 15] ^ w[(t + 8) & 15] ^ w[(t + 2) & 15] ^ w[t & 15], 1);
+      
+      if (t < 20) {
+        f = (bb & c) | (~bb & d);
+        k = 0x5A827999UL;
+      } else if (t < 40) {
+        f = bb ^ c ^ d;
+        k = 0x6ED9EBA1UL;
+      } else if (t < 60) {
+        f = (bb & c) | (bb & d) | (c & d);
+        k = 0x8F1BBCDCUL;
+      } else {
+        f = bb ^ c ^ d;
+        k = 0xCA62C1D6UL;
+      }
+      
+      tmp = _rol32(a, 5) + f + e + k + w[t & 15];
+      e = d;
+      d = c;
+      c = _rol32(bb, 30);
+      bb = a;
+      a = tmp;
+    }
+    
+    h[0] += a;
+    h[1] += bb;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+  }
+  
+  for (int i = 0;i < 20;++i)
+    digest[i] = (unsigned char)(h[i / 4] >> ((3 - i % 4) * 8));
+}
+
+// Base64 encoding of n bytes, returns length of terminated output
+inline int _base64(const unsigned char* s, int n, char* out) {
+  static const char table[] PROGMEM = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  int j = 0;
+  
+  for (int i = 0;i < n;i += 3) {
+    uint32_t v = ((uint32_t)s[i] << 16) |
+      ((i + 1 < n) ? ((uint32_t)s[i + 1] << 8) : (0)) | ((i + 2 < n) ? (s[i + 2]) : (0));
+    
+    out[j++] = pgm_read_byte(&table[(v >> 18) & 0x3F]);
+    out[j++] = pgm_read_byte(&table[(v >> 12) & 0x3F]);
+    out[j++] = (i + 1 < n) ? (pgm_read_byte(&table[(v >> 6) & 0x3F])) : ('=');
+    out[j++] = (i + 2 < n) ? (pgm_read_byte(&table[v & 0x3F])) : ('=');
+  }
+  
+  out[j] = '\0';
+  return j;
+}
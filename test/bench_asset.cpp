@@ -0,0 +1,60 @@
+#define HARNESS_NO_MAIN
+#include "harness.h"
+
+/*
+ * Static asset benchmark
+ * 
+ * 12 KB page sent from flash by blocks, against writing it one byte per call
+ * as print of flash string did before.
+ */
+int main() {
+  static char buf[1024];
+  static RESTASSET asset;
+  std::string page;
+  
+  for (int i = 0;page.size() < 12 * 1024;++i)
+    page += "<div id=\"row" + std::to_string(i) + "\">sensor</div>\n";
+  page.resize(12 * 1024);
+  strcpy(asset.url, "/index.html");
+  strcpy(asset.content_type, "text/html");
+  asset.data = page.data();
+  asset.length = page.size();
+  
+  int sizes[] = { 256, 1024 };
+  for (int k = 0;k < 2;++k) {
+    RESTful rest(buf, sizes[k], 64, (RESTHANDLER*)NULL, 0);
+    MockState m;
+    MockClient client(&m);
+    double begin;
+    double ns;
+    
+    rest.assets(&asset, 1);
+    m.push("GET /index.html HTTP/1.1\r\n\r\n");
+    m.halfclosed = true;
+    m.out.reserve(16 * 1024);
+    
+    printf("-- %d B buffer\n", sizes[k]);
+    begin = nanos();
+    bench("asset by blocks", 20000, &m, [&]() {
+      m.rewind();
+      rest.loop(client);
+    });
+    ns = (nanos() - begin) / (20000 + 20000 / 10 + 1);
+    printf("%-32s %10.1f MB/s\n", "throughput", page.size() / ns * 1e3);
+  }
+  
+  MockState m;
+  MockClient client(&m);
+  
+  m.out.reserve(16 * 1024);
+  printf("-- one byte per write\n");
+  bench("asset by bytes", 2000, &m, [&]() {
+    const char PROGMEM* p = page.data();
+    
+    m.rewind();
+    for (size_t i = 0;i < page.size();++i)
+      client.write((uint8_t)pgm_read_byte(&p[i]));
+  });
+  
+  return 0;
+}
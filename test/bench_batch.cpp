@@ -0,0 +1,66 @@
+#define HARNESS_NO_MAIN
+#define RESTFUL_BATCH
+#include "harness.h"
+
+/*
+ * Batch benchmark
+ * 
+ * Polling cycle of 30 routes, one batch request against 30 requests of their own.
+ * Figures are per cycle. Mock has no connection setup, bench_keepalive measures it over TCP.
+ */
+static void item(Request* req, Response* res, RESTCLIENT* client) {
+  (void)client;
+  g_sink += req->parameter_view(F("id")).len;
+  res->body(F("{\"on\":true}"));
+}
+
+static RESTHANDLER handlers[] = {
+  {"GET", "/api/leds/:id", item}
+};
+
+int main() {
+  static char buf[1024];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 1);
+  MockState batched;
+  MockState single[30];
+  MockClient bc(&batched);
+  std::vector<MockClient> sc;
+  std::string calls;
+  
+  for (int i = 0;i < 30;++i) {
+    std::string url = "/api/leds/" + std::to_string(i);
+    
+    calls += "GET " + url + "\n";
+    single[i].push("GET " + url + " HTTP/1.1\r\nHost: device\r\nConnection: close\r\n\r\n");
+    single[i].halfclosed = true;
+    single[i].out.reserve(1024);
+    sc.push_back(MockClient(&single[i]));
+  }
+  
+  batched.push("POST " RESTFUL_BATCH_URL " HTTP/1.1\r\nHost: device\r\nConnection: close\r\n"
+    "Content-Length: " + std::to_string(calls.size()) + "\r\n\r\n" + calls);
+  batched.halfclosed = true;
+  batched.out.reserve(4096);
+  
+  bench("30 routes batched", 5000, &batched, [&]() {
+    batched.rewind();
+    rest.loop(bc);
+  });
+  
+  // Counters of 30 peers are summed into first one
+  bench("30 routes one by one", 5000, &single[0], [&]() {
+    for (int i = 0;i < 30;++i) {
+      single[i].rewind();
+      rest.loop(sc[i]);
+      if (i > 0) {
+        single[0].reads += single[i].reads;
+        single[0].writes += single[i].writes;
+        single[0].bytes_in += single[i].bytes_in;
+        single[0].bytes_out += single[i].bytes_out;
+        single[i].clear();
+      }
+    }
+  });
+  
+  return 0;
+}
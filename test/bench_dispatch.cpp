@@ -0,0 +1,95 @@
+#define HARNESS_NO_MAIN
+#include "harness.h"
+
+/*
+ * Dispatch benchmark
+ * 
+ * Same routes declared as handler array, scanned by findhdlr or walked through route index,
+ * and as RESTROUTE table placed in flash, scanned by findroute or walked through its index.
+ * Requests hit first, middle and last route and miss every route.
+ */
+static void cb(Request* req, Response* res, RESTCLIENT* client) {
+  (void)req;
+  (void)res;
+  (void)client;
+}
+
+static void run(int n) {
+  std::vector<std::string> urls;
+  std::vector<RESTHANDLER> handlers;
+  std::vector<RESTROUTE> routes(n);
+  std::vector<RESTNODE> index(4 * n + 8);
+  std::vector<RESTNODE> pindex(4 * n + 8);
+  RESTHANDLER* h = NULL;
+  const char* methods[] = { "GET", "POST" };
+  
+  for (int i = 0;i < n;++i)
+    urls.push_back("/api/dev" + std::to_string(i / 2) + ((i % 2) ? ("/:channel") : ("/state")));
+  for (int i = 0;i < n;++i) {
+    RESTHANDLER x = { methods[(i / 2) % 2], urls[i].c_str(), cb, 0 };
+    
+    handlers.push_back(x);
+    routes[i].method = _parsemethod(x.method);
+    routes[i].url = x.url;
+    routes[i].request_callback = cb;
+    routes[i].flags = 0;
+  }
+  if (!RESTful::buildidx(&index[0], index.size(), &handlers[0], n) ||
+      !RESTful::buildidx_P(&pindex[0], pindex.size(), &routes[0], n)) {
+    printf("index does not fit\n");
+    return;
+  }
+  
+  struct {
+    const char* name;
+    const char* method;
+    std::string url;
+  } target[] = {
+    { "first", "GET", "/api/dev0/state" },
+    { "middle", methods[(n / 4) % 2], "/api/dev" + std::to_string(n / 4) + "/7" },
+    { "last", methods[((n - 1) / 2) % 2], "/api/dev" + std::to_string((n - 1) / 2) + "/7" },
+    { "miss", "GET", "/api/none/state" }
+  };
+  
+  printf("-- %d routes\n", n);
+  for (int k = 0;k < 4;++k) {
+    char s[64];
+    char label[64];
+    Header ihdr;
+    Header ohdr;
+    Request req(&ihdr);
+    Response res(&ohdr);
+    RESTROUTE route;
+    RESTMETHOD method = _parsemethod(target[k].method);
+    
+    strcpy(s, target[k].url.c_str());
+    req._url = s;
+    req._failed = false;
+    
+    snprintf(label, sizeof(label), "%s, findhdlr", target[k].name);
+    bench(label, 1000000 / n + 1000, NULL, [&]() {
+      h = RESTful::findhdlr(&handlers[0], n, target[k].method, &req, &res);
+      g_sink += (h != NULL);
+    });
+    snprintf(label, sizeof(label), "%s, route index", target[k].name);
+    bench(label, 1000000, NULL, [&]() {
+      h = RESTful::findidx(&index[0], &handlers[0], target[k].method, &req, &res);
+      g_sink += (h != NULL);
+    });
+    snprintf(label, sizeof(label), "%s, findroute", target[k].name);
+    bench(label, 1000000 / n + 1000, NULL, [&]() {
+      g_sink += RESTful::findroute(&routes[0], n, method, &req, &res, &route);
+    });
+    snprintf(label, sizeof(label), "%s, route table index", target[k].name);
+    bench(label, 1000000, NULL, [&]() {
+      g_sink += RESTful::findidx_P(&pindex[0], &routes[0], method, &req, &res, &route);
+    });
+  }
+}
+
+int main() {
+  run(10);
+  run(50);
+  run(200);
+  return 0;
+}
@@ -0,0 +1,37 @@
+#define HARNESS_NO_MAIN
+#include "harness.h"
+
+/*
+ * Event broadcast benchmark
+ * 
+ * One event sent to growing number of subscribers, it is formatted once for all of them.
+ */
+int main() {
+  static char buf[512];
+  static char evbuf[256];
+  static RESTSUBSCRIBER subs[128];
+  int counts[] = { 1, 8, 32, 128 };
+  
+  for (int k = 0;k < 4;++k) {
+    RESTful rest(buf, sizeof(buf), 64, (RESTHANDLER*)NULL, 0);
+    std::vector<MockState> m(counts[k]);
+    char label[64];
+    
+    rest.subscribers(subs, counts[k], evbuf, sizeof(evbuf));
+    for (int i = 0;i < counts[k];++i) {
+      MockClient client(&m[i]);
+      
+      m[i].out.reserve(64);
+      rest.subscribe(client);
+    }
+    
+    snprintf(label, sizeof(label), "broadcast, %d subscribers", counts[k]);
+    bench(label, 200000 / counts[k], NULL, [&]() {
+      for (int i = 0;i < counts[k];++i)
+        m[i].out.clear();
+      g_sink += rest.broadcast("reading", "{\"temp\":21.5,\"humidity\":40}");
+    });
+  }
+  
+  return 0;
+}
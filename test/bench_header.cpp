@@ -0,0 +1,65 @@
+#define HARNESS_NO_MAIN
+#include "harness.h"
+
+/*
+ * Header lookup benchmark
+ * 
+ * Six lookups a handler typically does, through field table built once
+ * and through scanning whole header for each lookup as before it.
+ */
+int main() {
+  static char buf[1024];
+  static char snapshot[1024];
+  const char* captures[] = { "chrome.http", "firefox.http", "curl.http" };
+  
+  for (int k = 0;k < 3;++k) {
+    std::string s = corpus(captures[k]);
+    char rbuf[64];
+    int presz = 0;
+    Header ihdr;
+    Header ohdr;
+    Request req(&ihdr);
+    Response res(&ohdr);
+    RESTful rest(buf, sizeof(buf), 64, (RESTHANDLER*)NULL, 0);
+    MockState m;
+    MockClient client(&m);
+    int scanned;
+    
+    m.push(s);
+    rest.recvall(&client, 1000, &rest._conn, &presz);
+    scanned = rest._conn.recvsz + 2;
+    memcpy(snapshot, rest._conn.buf, scanned);
+    
+    auto lookups = [&]() {
+      g_sink += req.header()->get_view(F("Authorization")).len;
+      g_sink += req.header()->get_view(F("Content-Type")).len;
+      g_sink += req.header()->get_view(F("Content-Length")).len;
+      g_sink += req.header()->get_view(F("Accept")).len;
+      g_sink += req.header()->get_view(F("If-None-Match")).len;
+      g_sink += req.header()->get_view(F("Accept-Encoding")).len;
+    };
+    
+    printf("-- %s\n", captures[k]);
+    bench("build and 6 lookups, indexed", 100000, NULL, [&]() {
+      memcpy(rest._conn.buf, snapshot, scanned);
+      RESTful::buildreq(rest._conn.buf, rest._conn.bufsz, rbuf, sizeof(rbuf), presz, &req, &res);
+      lookups();
+    });
+    bench("build and 6 lookups, scanned", 100000, NULL, [&]() {
+      memcpy(rest._conn.buf, snapshot, scanned);
+      RESTful::buildreq(rest._conn.buf, rest._conn.bufsz, rbuf, sizeof(rbuf), presz, &req, &res);
+      ihdr._nfields = -1;
+      lookups();
+    });
+    bench("index and 6 lookups", 100000, NULL, [&]() {
+      ihdr.index(req._fields, RESTFUL_HEADER_FIELDS);
+      lookups();
+    });
+    bench("6 lookups, scanned", 100000, NULL, [&]() {
+      ihdr._nfields = -1;
+      lookups();
+    });
+  }
+  
+  return 0;
+}
@@ -0,0 +1,109 @@
+#define RESTFUL_POSIX
+#include "RESTful.h"
+#include <arpa/inet.h>
+
+/*
+ * Keep-alive benchmark
+ * 
+ * Requests per second over loopback TCP, one connection per request against one connection for all.
+ * Client and server run in turn in one thread, so each request waits for previous response.
+ */
+static void ok(Request* req, Response* res, RESTCLIENT* client) {
+  (void)req;
+  (void)client;
+  res->body(F("{\"temp\":21.5}"));
+}
+
+static RESTHANDLER handlers[] = {
+  {"GET", "/api/sensors/:id", ok}
+};
+
+static double nanos() {
+  struct timespec ts;
+  
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int dial(int port) {
+  struct sockaddr_in addr;
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  int on = 1;
+  
+  memset(&addr, 0x00, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    perror("connect");
+    exit(1);
+  }
+  
+  return fd;
+}
+
+// Send request, serve it and read whole response
+static void exchange(RESTful& rest, PosixClient& client, int fd, const char* req, int reqsz) {
+  char buf[512];
+  int n = 0;
+  
+  if (write(fd, req, reqsz) != reqsz)
+    exit(1);
+  while (rest.poll(client) == RESTFUL_NEED_MORE)
+    ;
+  while (n == 0 || memcmp(&buf[n - 13], "{\"temp\":21.5}", 13)) {
+    int r = read(fd, &buf[n], sizeof(buf) - n);
+    
+    if (r <= 0)
+      exit(1);
+    n += r;
+  }
+}
+
+int main() {
+  static char buf[1024];
+  RESTful rest(buf, sizeof(buf), 128, handlers, 1);
+  PosixServer server(18081);
+  const char* close = "GET /api/sensors/3 HTTP/1.1\r\nHost: x\r\nConnection: close\r\n\r\n";
+  const char* keep = "GET /api/sensors/3 HTTP/1.1\r\nHost: x\r\n\r\n";
+  const int n = 20000;
+  double begin;
+  
+  if (!server.begin()) {
+    perror("begin");
+    return 1;
+  }
+  
+  begin = nanos();
+  for (int i = 0;i < n;++i) {
+    PosixClient client;
+    int fd = dial(18081);
+    
+    server.wait(1000);
+    while (!server.accept(client))
+      server.wait(1000);
+    exchange(rest, client, fd, close, strlen(close));
+    client.stop();
+    ::close(fd);
+  }
+  printf("%-32s %10.0f req/s\n", "without keep-alive", n / ((nanos() - begin) / 1e9));
+  
+  rest.keepalive_requests(n + 1);
+  begin = nanos();
+  {
+    PosixClient client;
+    int fd = dial(18081);
+    
+    server.wait(1000);
+    while (!server.accept(client))
+      server.wait(1000);
+    for (int i = 0;i < n;++i)
+      exchange(rest, client, fd, keep, strlen(keep));
+    client.stop();
+    ::close(fd);
+  }
+  printf("%-32s %10.0f req/s\n", "with keep-alive", n / ((nanos() - begin) / 1e9));
+  
+  return 0;
+}
@@ -0,0 +1,200 @@
+#define RESTFUL_POSIX
+#include "RESTful.h"
+#include <arpa/inet.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <vector>
+
+/*
+ * Loopback load generator
+ * 
+ * Server runs in forked process, serving ready slots of PosixServer only.
+ * Generator keeps each connection busy with one keep-alive request at a time, as wrk does,
+ * and reports requests per second and latency percentiles.
+ * 
+ * bench_loadgen [connections] [seconds]
+ */
+static const int PORT = 18085;
+static const int POOL = 256;
+
+static void sensor(Request* req, Response* res, RESTCLIENT* client) {
+  (void)client;
+  res->header()->set(F("Content-Type"), F("application/json"));
+  res->body(String("{\"id\":\"") + String(req->parameter(F("id"))) + String("\",\"temp\":21.5}"));
+}
+
+static RESTHANDLER handlers[] = {
+  {"GET", "/api/sensors/:id", sensor}
+};
+
+static double nanos() {
+  struct timespec ts;
+  
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void serve(int ready) {
+  static char buf[POOL * 512];
+  static RESTCONNECTION conn[POOL];
+  RESTful rest(buf, sizeof(buf), 128, handlers, 1);
+  PosixServer server(PORT);
+  unsigned long swept = millis();
+  
+  rest.connections(conn, POOL);
+  rest.keepalive_requests(1000000);
+  rest.keepalive_timeout(5000);
+  if (!server.begin()) {
+    perror("begin");
+    exit(1);
+  }
+  if (write(ready, "1", 1) != 1)
+    exit(1);
+  
+  while (true) {
+    PosixClient client;
+    
+    server.wait(10);
+    while (server.accept(client)) {
+      int slot = rest.attach(client);
+      
+      if (slot < 0 || !server.watch(client, slot))
+        client.stop();
+    }
+    
+    for (int i = 0;i < server.ready();++i)
+      rest.service(server.slot(i));
+    
+    // Deadlines are checked every few milliseconds, not on every event
+    if (millis() - swept >= 5) {
+      rest.sweep();
+      swept = millis();
+    }
+  }
+}
+
+static int dial() {
+  struct sockaddr_in addr;
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  int on = 1;
+  
+  memset(&addr, 0x00, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(PORT);
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    perror("connect");
+    exit(1);
+  }
+  
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+  return fd;
+}
+
+struct Conn {
+  int fd;
+  double sent;
+  std::string in;
+};
+
+// Response ends with its body, whose length is given by Content-Length
+static bool complete(const std::string& s) {
+  size_t eoh = s.find("\r\n\r\n");
+  size_t cl = s.find("Content-Length: ");
+  
+  return (eoh != std::string::npos && cl != std::string::npos &&
+    s.size() >= eoh + 4 + atol(s.c_str() + cl + 16));
+}
+
+int main(int argc, char** argv) {
+  int nconn = (argc > 1) ? (atoi(argv[1])) : (64);
+  double seconds = (argc > 2) ? (atof(argv[2])) : (2);
+  const char* req = "GET /api/sensors/7 HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  int reqsz = strlen(req);
+  std::vector<Conn> conns(nconn);
+  std::vector<double> lat;
+  int p[2];
+  char c;
+  pid_t pid;
+  int epfd = epoll_create1(0);
+  long errors = 0;
+  double begin;
+  double end;
+  
+  signal(SIGPIPE, SIG_IGN);
+  if (nconn > POOL) {
+    fprintf(stderr, "at most %d connections\n", POOL);
+    return 1;
+  }
+  if (pipe(p) < 0 || (pid = fork()) < 0)
+    return 1;
+  if (pid == 0) {
+    close(p[0]);
+    serve(p[1]);
+    return 0;
+  }
+  close(p[1]);
+  if (read(p[0], &c, 1) != 1)
+    return 1;
+  
+  begin = nanos();
+  for (int i = 0;i < nconn;++i) {
+    struct epoll_event ev;
+    
+    conns[i].fd = dial();
+    ev.events = EPOLLIN;
+    ev.data.u32 = i;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, conns[i].fd, &ev);
+    conns[i].sent = nanos();
+    if (write(conns[i].fd, req, reqsz) != reqsz)
+      errors++;
+  }
+  
+  end = begin + seconds * 1e9;
+  while (nanos() < end) {
+    struct epoll_event ev[64];
+    int n = epoll_wait(epfd, ev, 64, 100);
+    
+    for (int k = 0;k < n;++k) {
+      Conn* x = &conns[ev[k].data.u32];
+      char buf[4096];
+      int r = read(x->fd, buf, sizeof(buf));
+      
+      if (r <= 0) {
+        errors++;
+        epoll_ctl(epfd, EPOLL_CTL_DEL, x->fd, NULL);
+        continue;
+      }
+      
+      x->in.append(buf, r);
+      if (!complete(x->in))
+        continue;
+      
+      lat.push_back(nanos() - x->sent);
+      x->in.clear();
+      x->sent = nanos();
+      if (write(x->fd, req, reqsz) != reqsz)
+        errors++;
+    }
+  }
+  end = nanos();
+  
+  kill(pid, SIGTERM);
+  waitpid(pid, NULL, 0);
+  for (int i = 0;i < nconn;++i)
+    close(conns[i].fd);
+  close(epfd);
+  
+  std::sort(lat.begin(), lat.end());
+  if (lat.empty()) {
+    fprintf(stderr, "no response\n");
+    return 1;
+  }
+  
+  printf("%d connections, %.1f s, %zu requests, %ld errors\n", nconn, (end - begin) / 1e9, lat.size(), errors);
+  printf("%-32s %10.0f req/s\n", "throughput", lat.size() / ((end - begin) / 1e9));
+  printf("%-32s %10.1f us p50 %10.1f us p90 %10.1f us p99 %10.1f us max\n", "latency",
+    lat[lat.size() / 2] / 1e3, lat[lat.size() * 9 / 10] / 1e3, lat[lat.size() * 99 / 100] / 1e3, lat.back() / 1e3);
+  return 0;
+}
@@ -0,0 +1,112 @@
+#define HARNESS_NO_MAIN
+#include "harness.h"
+
+/*
+ * Request pipeline benchmark
+ * 
+ * Each stage runs over captures of corpus, then whole loop serves them end to end.
+ */
+static void sensor(Request* req, Response* res, RESTCLIENT* client) {
+  (void)client;
+  g_sink += req->parameter_view(F("id")).len + req->query_view(F("unit")).len;
+  res->body(F("{\"temp\":21.5,\"humidity\":40}"));
+}
+
+static void update(Request* req, Response* res, RESTCLIENT* client) {
+  (void)req;
+  (void)client;
+  res->body(F("{\"ok\":true}"));
+}
+
+static RESTHANDLER handlers[] = {
+  {"GET", "/", update},
+  {"GET", "/api/status", update},
+  {"GET", "/api/leds", update},
+  {"GET", "/api/leds/:id", update},
+  {"POST", "/api/leds/:id", update},
+  {"GET", "/api/config", update},
+  {"PUT", "/api/config", update},
+  {"GET", "/api/sensors", update},
+  {"GET", "/api/sensors/:id", sensor},
+  {"DELETE", "/api/sensors/:id", update}
+};
+
+static const char* captures[] = { "chrome.http", "firefox.http", "curl.http", "curl-post.http", "chrome-put.http" };
+
+int main() {
+  static char buf[1024];
+  RESTful rest(buf, sizeof(buf), 256, handlers, 10);
+  MockState m;
+  MockClient client(&m);
+  
+  rest.keepalive_requests(1);
+  for (size_t k = 0;k < sizeof(captures) / sizeof(captures[0]);++k) {
+    std::string s = corpus(captures[k]);
+    std::string name;
+    char snapshot[1024];
+    int scanned;
+    int presz = 0;
+    Header ihdr;
+    Header ohdr;
+    Request req(&ihdr);
+    Response res(&ohdr);
+    char rbuf[256];
+    
+    printf("-- %s (%d bytes)\n", captures[k], (int)s.size());
+    m.reset();
+    m.push(s);
+    
+    name = std::string("recvall ") + captures[k];
+    bench(name.c_str(), 20000, &m, [&]() {
+      m.rewind();
+      rest.recvall(&client, 1000, &rest._conn, &presz);
+    });
+    
+    // Scanned request is restored before each build, since building splits it in place
+    scanned = rest._conn.recvsz + 2;
+    memcpy(snapshot, rest._conn.buf, scanned);
+    bench("buildreq", 200000, NULL, [&]() {
+      memcpy(rest._conn.buf, snapshot, scanned);
+      RESTful::buildreq(rest._conn.buf, rest._conn.bufsz, rbuf, sizeof(rbuf), presz, &req, &res);
+    });
+    
+    bench("findhdlr", 200000, NULL, [&]() {
+      g_sink += (long)RESTful::findhdlr(handlers, 10, req.method(), &req, &res);
+    });
+    
+    bench("urlmatch", 200000, NULL, [&]() {
+      g_sink += RESTful::urlmatch("/api/sensors/:id", req.url());
+    });
+    
+    bench("Header::get_view", 200000, NULL, [&]() {
+      g_sink += req.header()->get_view(F("Accept-Encoding")).len;
+    });
+    
+    bench("Header::get", 200000, NULL, [&]() {
+      g_sink += req.header()->get(F("Accept-Encoding")).length();
+    });
+    
+    bench("Request::query_view", 200000, NULL, [&]() {
+      g_sink += req.query_view(F("fields")).len;
+    });
+    
+    bench("Request::query", 200000, NULL, [&]() {
+      g_sink += req.query(F("fields")).length();
+    });
+    
+    bench("Request::parameter_view", 200000, NULL, [&]() {
+      g_sink += req.parameter_view(F("id")).len;
+    });
+    
+    bench("Request::parameter", 200000, NULL, [&]() {
+      g_sink += req.parameter(F("id")).length();
+    });
+    
+    bench("loop", 20000, &m, [&]() {
+      m.rewind();
+      rest.loop(client);
+    });
+  }
+  
+  return 0;
+}
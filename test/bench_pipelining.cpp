@@ -0,0 +1,57 @@
+#define HARNESS_NO_MAIN
+#include "harness.h"
+
+/*
+ * Pipelining benchmark
+ * 
+ * 100 GETs sent back to back on one connection, against 100 connections of one request each.
+ * Figures are per 100 requests. Mock has no connection setup, bench_keepalive measures it over TCP.
+ * Pipelined responses must not take more writes than sequential ones, benchmark fails otherwise.
+ */
+static void item(Request* req, Response* res, RESTCLIENT* client) {
+  (void)client;
+  g_sink += req->parameter_view(F("id")).len;
+  res->body(F("{\"on\":true}"));
+}
+
+static RESTHANDLER handlers[] = {
+  {"GET", "/api/leds/:id", item}
+};
+
+int main() {
+  static char buf[2048];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 1);
+  MockState pipelined;
+  MockState single;
+  MockClient pc(&pipelined);
+  MockClient sc(&single);
+  std::string all;
+  
+  for (int i = 0;i < 100;++i)
+    all += "GET /api/leds/" + std::to_string(i % 8) + " HTTP/1.1\r\nHost: device\r\n\r\n";
+  
+  rest.keepalive_requests(1000);
+  pipelined.push(all);
+  pipelined.halfclosed = true;
+  pipelined.out.reserve(64 * 1024);
+  single.push("GET /api/leds/3 HTTP/1.1\r\nHost: device\r\nConnection: close\r\n\r\n");
+  single.halfclosed = true;
+  single.out.reserve(1024);
+  
+  bench("100 pipelined", 2000, &pipelined, [&]() {
+    pipelined.rewind();
+    rest.loop(pc);
+  });
+  bench("100 sequential connections", 2000, &single, [&]() {
+    for (int i = 0;i < 100;++i) {
+      single.rewind();
+      rest.loop(sc);
+    }
+  });
+  
+  if (pipelined.writes > single.writes) {
+    fprintf(stderr, "pipelined responses take %ld writes against %ld\n", pipelined.writes / 2000, single.writes / 2000);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,81 @@
+#define HARNESS_NO_MAIN
+#include "harness.h"
+
+/*
+ * Streaming response benchmark
+ * 
+ * 64 KB sensor history sent through producer and through String built in handler.
+ * Peak heap and time to first byte are reported besides time per response.
+ */
+static const long TOTAL = 64 * 1024;
+
+struct History {
+  long sent;
+};
+
+static History g_history;
+
+static int history(char* buf, int n, void* context) {
+  History* h = (History*)context;
+  int k = (int)std::min((long)n, TOTAL - h->sent);
+  
+  for (int i = 0;i < k;++i)
+    buf[i] = '0' + (h->sent + i) % 10;
+  h->sent += k;
+  return k;
+}
+
+static void streamed(Request* req, Response* res, RESTCLIENT* client) {
+  (void)req;
+  (void)client;
+  g_history.sent = 0;
+  res->stream(history, &g_history);
+}
+
+static void buffered(Request* req, Response* res, RESTCLIENT* client) {
+  String s;
+  
+  (void)req;
+  (void)client;
+  for (long i = 0;i < TOTAL;++i)
+    s += (char)('0' + i % 10);
+  res->body(s);
+}
+
+static RESTHANDLER handlers[] = {
+  {"GET", "/stream", streamed},
+  {"GET", "/string", buffered}
+};
+
+int main() {
+  static char buf[1024];
+  const char* urls[] = { "/stream", "/string" };
+  
+  for (int k = 0;k < 2;++k) {
+    RESTful rest(buf, sizeof(buf), 64, handlers, 2);
+    MockState m;
+    MockClient client(&m);
+    double ttfb = 0;
+    long peak = 0;
+    const long iters = 2000;
+    
+    m.push(std::string("GET ") + urls[k] + " HTTP/1.1\r\n\r\n");
+    m.halfclosed = true;
+    m.out.reserve(2 * TOTAL);
+    
+    printf("-- GET %s, %ld bytes\n", urls[k], TOTAL);
+    bench("response", iters, &m, [&]() {
+      double begin;
+      
+      m.rewind();
+      g_heappeak = g_heap;
+      begin = nanos();
+      rest.loop(client);
+      ttfb += m.firstout - begin;
+      peak = std::max(peak, g_heappeak - g_heap);
+    });
+    printf("%-32s %10.1f ns %8ld B peak heap\n", "time to first byte", ttfb / (iters + iters / 10 + 1), peak);
+  }
+  
+  return 0;
+}
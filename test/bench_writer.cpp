@@ -0,0 +1,104 @@
+#define HARNESS_NO_MAIN
+#include "harness.h"
+
+/*
+ * Response body benchmark
+ * 
+ * JSON list of sensor readings built by Writer in fixed area and by String concatenation,
+ * alone and served end to end.
+ */
+static int g_items = 0;
+
+static void build(Print* p) {
+  p->print(F("{\"items\":["));
+  for (int i = 0;i < g_items;++i) {
+    if (i > 0)
+      p->print(',');
+    p->print(F("{\"id\":"));
+    p->print(i);
+    p->print(F(",\"name\":\"sensor\",\"value\":"));
+    p->print((long)i * 17);
+    p->print('}');
+  }
+  p->print(F("]}"));
+}
+
+static void concat(String* s) {
+  *s += F("{\"items\":[");
+  for (int i = 0;i < g_items;++i) {
+    if (i > 0)
+      *s += ',';
+    *s += F("{\"id\":");
+    *s += String((long)i);
+    *s += F(",\"name\":\"sensor\",\"value\":");
+    *s += String((long)i * 17);
+    *s += '}';
+  }
+  *s += F("]}");
+}
+
+static void written(Request* req, Response* res, RESTCLIENT* client) {
+  (void)req;
+  (void)client;
+  build(res->writer());
+}
+
+static void concatenated(Request* req, Response* res, RESTCLIENT* client) {
+  String s;
+  
+  (void)req;
+  (void)client;
+  concat(&s);
+  res->body(s);
+}
+
+static RESTHANDLER handlers[] = {
+  {"GET", "/writer", written},
+  {"GET", "/string", concatenated}
+};
+
+int main() {
+  static char buf[8192];
+  static char area[4096];
+  int counts[] = { 10, 100 };
+  
+  for (int k = 0;k < 2;++k) {
+    RESTful rest(buf, sizeof(buf), 64, handlers, 2);
+    MockState mw;
+    MockState ms;
+    MockClient cw(&mw);
+    MockClient cs(&ms);
+    
+    g_items = counts[k];
+    rest.writer_buffer_size(4096);
+    mw.push("GET /writer HTTP/1.1\r\n\r\n");
+    ms.push("GET /string HTTP/1.1\r\n\r\n");
+    mw.halfclosed = ms.halfclosed = true;
+    mw.out.reserve(8192);
+    ms.out.reserve(8192);
+    
+    printf("-- %d items\n", g_items);
+    bench("build, Writer", 100000, NULL, [&]() {
+      Writer w(area, sizeof(area));
+      
+      build(&w);
+      g_sink += w.length();
+    });
+    bench("build, String", 100000, NULL, [&]() {
+      String s;
+      
+      concat(&s);
+      g_sink += s.length();
+    });
+    bench("served, Writer", 20000, &mw, [&]() {
+      mw.rewind();
+      rest.loop(cw);
+    });
+    bench("served, String", 20000, &ms, [&]() {
+      ms.rewind();
+      rest.loop(cs);
+    });
+  }
+  
+  return 0;
+}
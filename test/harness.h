@@ -0,0 +1,444 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <new>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+/*
+ * Host test harness
+ * 
+ * RESTful is built on Linux with rfposix.h and served through MockClient,
+ * which replays scripted input fragments and records every call made on it.
+ * Private members are opened to tests, so internal steps can be measured one by one.
+ * Tests over real sockets define RESTFUL_CLIENT as PosixClient before including it.
+ */
+#define RESTFUL_POSIX
+#ifndef RESTFUL_CLIENT
+#define RESTFUL_CLIENT                            MockClient
+#endif
+#include "rfposix.h"
+
+
+// Heap allocations made since start, counted by global operator new
+static long g_allocs = 0;
+static long g_allocbytes = 0;
+
+// Bytes held on heap now and at most, peak is reset by tests
+static long g_heap = 0;
+static long g_heappeak = 0;
+
+void* operator new(size_t n) {
+  void* p = malloc((n > 0) ? (n) : (1));
+  
+  if (p == NULL)
+    throw std::bad_alloc();
+  
+  g_allocs++;
+  g_allocbytes += n;
+  g_heap += malloc_usable_size(p);
+  g_heappeak = std::max(g_heappeak, g_heap);
+  return p;
+}
+
+void* operator new[](size_t n) {
+  return operator new(n);
+}
+
+void operator delete(void* p) noexcept {
+  if (p != NULL)
+    g_heap -= malloc_usable_size(p);
+  free(p);
+}
+
+void operator delete[](void* p) noexcept {
+  operator delete(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  operator delete(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+  operator delete(p);
+}
+
+inline double nanos() {
+  struct timespec ts;
+  
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+/*
+ * Mock peer
+ * 
+ * Input is given as fragments. Released fragments are readable, others arrive on release.
+ * At most maxread bytes are returned by one read and at most maxwrite bytes are taken by one write,
+ * so slow or trickling peers can be scripted. Zero means no limit.
+ * Each write takes writedelay microseconds, as writes to slow reader do.
+ * When segmented is true, one read never crosses end of fragment.
+ * Time of first write since reset is kept in firstout, in nanoseconds.
+ */
+struct MockState {
+  std::vector<std::string> in;
+  size_t released;
+  size_t chunk;
+  size_t pos;
+  int maxread;
+  int maxwrite;
+  int writedelay;
+  bool segmented;
+  bool open;
+  bool halfclosed;
+  long reads;
+  long writes;
+  long availables;
+  long stops;
+  long bytes_in;
+  long bytes_out;
+  double firstout;
+  std::string out;
+  
+  MockState() {
+    this->reset();
+  }
+  
+  void reset() {
+    this->in.clear();
+    this->released = (size_t)-1;
+    this->chunk = 0;
+    this->pos = 0;
+    this->maxread = 0;
+    this->maxwrite = 0;
+    this->writedelay = 0;
+    this->segmented = false;
+    this->open = true;
+    this->halfclosed = false;
+    this->firstout = 0;
+    this->out.clear();
+    this->clear();
+  }
+  
+  // Counters are cleared, input and output are kept
+  void clear() {
+    this->reads = 0;
+    this->writes = 0;
+    this->availables = 0;
+    this->stops = 0;
+    this->bytes_in = 0;
+    this->bytes_out = 0;
+  }
+  
+  // Replay input from start, used by benchmarks repeating the same request
+  void rewind() {
+    this->chunk = 0;
+    this->pos = 0;
+    this->open = true;
+    this->firstout = 0;
+    this->out.clear();
+  }
+  
+  void push(const std::string& s) {
+    this->in.push_back(s);
+  }
+  
+  // Each byte of s is released separately
+  void trickle(const std::string& s) {
+    for (size_t i = 0;i < s.size();++i)
+      this->in.push_back(std::string(1, s[i]));
+  }
+  
+  // Only n fragments are readable until next release
+  void hold(size_t n) {
+    this->released = n;
+  }
+  
+  void release(size_t n = 1) {
+    this->released += n;
+  }
+  
+  size_t pending() const {
+    size_t end = std::min(this->released, this->in.size());
+    size_t n = 0;
+    
+    for (size_t i = this->chunk;i < end;++i)
+      n += this->in[i].size() - ((i == this->chunk) ? (this->pos) : (0));
+    
+    return n;
+  }
+  
+  int read(uint8_t* buf, int n) {
+    int m = 0;
+    
+    if (this->maxread > 0)
+      n = std::min(n, this->maxread);
+    
+    while (m < n && this->chunk < std::min(this->released, this->in.size())) {
+      const std::string& s = this->in[this->chunk];
+      int k = std::min(n - m, (int)(s.size() - this->pos));
+      
+      memcpy(&buf[m], s.data() + this->pos, k);
+      m += k;
+      this->pos += k;
+      if (this->pos == s.size()) {
+        this->chunk++;
+        this->pos = 0;
+        if (this->segmented)
+          break;
+      }
+    }
+    
+    return m;
+  }
+};
+
+
+class MockClient : public Print {
+private:
+  MockState* _m;
+  
+public:
+  MockClient(MockState* m = NULL) {
+    this->_m = m;
+  }
+  
+  int available() {
+    if (this->_m == NULL)
+      return 0;
+    
+    this->_m->availables++;
+    return (int)this->_m->pending();
+  }
+  
+  int read(uint8_t* buf, size_t n) {
+    int m;
+    
+    if (this->_m == NULL)
+      return -1;
+    
+    this->_m->reads++;
+    m = this->_m->read(buf, (int)n);
+    this->_m->bytes_in += m;
+    return (m > 0) ? (m) : (-1);
+  }
+  
+  int read() {
+    uint8_t c;
+    return (this->read(&c, 1) == 1) ? (c) : (-1);
+  }
+  
+  virtual size_t write(uint8_t c) {
+    return this->write(&c, 1);
+  }
+  
+  virtual size_t write(const uint8_t* s, size_t n) {
+    if (this->_m == NULL || !this->_m->open)
+      return 0;
+    
+    if (this->_m->maxwrite > 0)
+      n = std::min(n, (size_t)this->_m->maxwrite);
+    
+    if (this->_m->writedelay > 0)
+      usleep(this->_m->writedelay);
+    if (this->_m->firstout == 0)
+      this->_m->firstout = nanos();
+    
+    this->_m->writes++;
+    this->_m->bytes_out += n;
+    this->_m->out.append((const char*)s, n);
+    return n;
+  }
+  
+  using Print::write;
+  
+  // Half-closed peer is gone once its input is read
+  uint8_t connected() {
+    if (this->_m == NULL || !this->_m->open)
+      return 0;
+    
+    return !(this->_m->halfclosed && this->_m->pending() == 0);
+  }
+  
+  void stop() {
+    if (this->_m == NULL)
+      return;
+    
+    this->_m->stops++;
+    this->_m->open = false;
+  }
+  
+  void flush() {
+  }
+  
+  operator bool() const {
+    return (this->_m != NULL && this->_m->open);
+  }
+  
+  bool operator==(const MockClient& client) const {
+    return (this->_m == client._m);
+  }
+};
+
+
+#define private public
+#include "RESTful.h"
+#undef private
+
+
+/*
+ * Request captures
+ * 
+ * Corpus files keep header lines with LF, they are sent with CRLF as captured.
+ * Body after blank line is sent as it is.
+ */
+inline std::string corpus(const char* name) {
+  std::string path = std::string(RESTFUL_CORPUS_DIR) + "/" + name;
+  std::string s;
+  std::string r;
+  FILE* f = fopen(path.c_str(), "rb");
+  char buf[512];
+  size_t n;
+  size_t eoh;
+  
+  if (f == NULL) {
+    fprintf(stderr, "corpus %s is missing\n", path.c_str());
+    exit(2);
+  }
+  
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    s.append(buf, n);
+  fclose(f);
+  
+  eoh = s.find("\n\n");
+  eoh = (eoh == std::string::npos) ? (s.size()) : (eoh + 2);
+  for (size_t i = 0;i < eoh;++i) {
+    if (s[i] == '\n')
+      r += '\r';
+    r += s[i];
+  }
+  
+  return r + s.substr(eoh);
+}
+
+// Serve s through loop and return what was sent back
+// Template is only instantiated when RESTful is served through MockClient
+template <typename T>
+std::string roundtrip(T& rest, MockState& m, const std::string& s) {
+  MockClient client(&m);
+  
+  m.reset();
+  m.push(s);
+  m.halfclosed = true;
+  rest.loop(client);
+  return m.out;
+}
+
+// Count occurrences of needle in s
+inline int count(const std::string& s, const char* needle) {
+  int n = 0;
+  
+  for (size_t i = s.find(needle);i != std::string::npos;i = s.find(needle, i + 1))
+    ++n;
+  
+  return n;
+}
+
+
+/*
+ * Benchmarks
+ * 
+ * Body runs iters times, mock counters and allocations are reported per operation.
+ * Given MockState may be NULL when body does no I/O.
+ */
+static volatile long g_sink = 0;
+
+template <typename T>
+void bench(const char* name, long iters, MockState* m, T body) {
+  long allocs;
+  double begin;
+  double ns;
+  
+  for (long i = 0;i < iters / 10 + 1;++i)
+    body();
+  
+  if (m != NULL)
+    m->clear();
+  allocs = g_allocs;
+  begin = nanos();
+  for (long i = 0;i < iters;++i)
+    body();
+  ns = (nanos() - begin) / iters;
+  allocs = g_allocs - allocs;
+  
+  printf("%-32s %10.1f ns/op %8.2f allocs/op", name, ns, (double)allocs / iters);
+  if (m != NULL) {
+    printf(" %8.1f B in/op %8.1f B out/op %6.2f reads/op %6.2f writes/op",
+      (double)m->bytes_in / iters, (double)m->bytes_out / iters,
+      (double)m->reads / iters, (double)m->writes / iters);
+  }
+  printf("\n");
+}
+
+
+#ifndef HARNESS_NO_MAIN
+/*
+ * Tests
+ * 
+ * TEST(name) { CHECK(condition); } registers test run by main.
+ * Failed check ends its test and makes main return 1.
+ * Benchmarks define HARNESS_NO_MAIN and have main of their own.
+ */
+struct _TESTCASE_ {
+  const char* name;
+  void (*run)();
+};
+
+inline std::vector<_TESTCASE_>& testcases() {
+  static std::vector<_TESTCASE_> t;
+  return t;
+}
+
+static int g_failed = 0;
+
+struct _TESTREG_ {
+  _TESTREG_(const char* name, void (*run)()) {
+    _TESTCASE_ t = { name, run };
+    testcases().push_back(t);
+  }
+};
+
+#define TEST(name)                                                  \
+  static void name();                                               \
+  static _TESTREG_ name##_reg(#name, name);                         \
+  static void name()
+
+#define CHECK(c)                                                    \
+  do {                                                              \
+    if (!(c)) {                                                     \
+      fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #c); \
+      g_failed++;                                                   \
+      return;                                                       \
+    }                                                               \
+  } while (0)
+
+int main() {
+  std::vector<_TESTCASE_>& t = testcases();
+  
+  for (size_t i = 0;i < t.size();++i) {
+    int failed = g_failed;
+    
+    t[i].run();
+    printf("%s %s\n", (g_failed == failed) ? ("ok  ") : ("FAIL"), t[i].name);
+  }
+  
+  return (g_failed > 0) ? (1) : (0);
+}
+#endif
@@ -0,0 +1,146 @@
+#include "harness.h"
+
+/*
+ * Allocation-free request path
+ * 
+ * Handler reads through views and typed accessors and answers through writer,
+ * so serving request allocates nothing.
+ */
+static long g_id;
+static int g_unit;
+static float g_version;
+static std::string g_name;
+
+static void sensor(Request* req, Response* res, RESTCLIENT* client) {
+  RESTVIEW name = req->query_view(F("name"), true);
+  
+  (void)client;
+  g_id = req->parameter_long(F("id"), -1);
+  g_unit = req->query_int(F("unit"), -1);
+  g_version = req->header_float(F("X-Version"), 0.0f);
+  g_name.assign(name.str, name.len);
+  
+  res->writer()->print(F("{\"id\":"));
+  res->writer()->print(g_id);
+  res->writer()->print(F(",\"name\":\""));
+  res->writer()->print_escaped(name);
+  res->writer()->print(F("\"}"));
+}
+
+static RESTHANDLER handlers[] = {
+  {"GET", "/api/sensors/:id", sensor}
+};
+
+static const char* request =
+  "GET /api/sensors/42?unit=7&name=living%20room%22 HTTP/1.1\r\n"
+  "Host: 192.168.1.177\r\n"
+  "X-Version: 1.5\r\n"
+  "\r\n";
+
+TEST(request_path_does_not_allocate) {
+  static char buf[1024];
+  RESTful rest(buf, sizeof(buf), 128, handlers, 1);
+  MockState m;
+  MockClient client(&m);
+  long allocs;
+  
+  rest.writer_buffer_size(128);
+  m.in.reserve(4);
+  m.out.reserve(1024);
+  m.push(request);
+  m.halfclosed = true;
+  
+  allocs = g_allocs;
+  rest.loop(client);
+  CHECK(g_allocs == allocs);
+  
+  CHECK(g_id == 42);
+  CHECK(g_unit == 7);
+  CHECK(g_version == 1.5f);
+  CHECK(g_name == "living room\"");
+  CHECK(m.out.find("{\"id\":42,\"name\":\"living room\\\"\"}") != std::string::npos);
+}
+
+TEST(missing_or_invalid_values_give_default) {
+  static char buf[1024];
+  RESTful rest(buf, sizeof(buf), 128, handlers, 1);
+  MockState m;
+  
+  rest.writer_buffer_size(128);
+  roundtrip(rest, m, "GET /api/sensors/x42?unit=&name= HTTP/1.1\r\nX-Version: v2\r\n\r\n");
+  CHECK(g_id == -1);
+  CHECK(g_unit == -1);
+  CHECK(g_version == 0.0f);
+  CHECK(g_name == "");
+}
+
+TEST(values_out_of_range_give_default) {
+  static char buf[1024];
+  RESTful rest(buf, sizeof(buf), 128, handlers, 1);
+  MockState m;
+  
+  rest.writer_buffer_size(128);
+  roundtrip(rest, m, "GET /api/sensors/18446744073709551617 HTTP/1.1\r\n\r\n");
+  CHECK(g_id == -1);
+  CHECK(_strtol("2147483647", 10, -1) == 2147483647L);
+  CHECK(_strtol("-2147483647", 11, 0) == -2147483647L);
+  CHECK(_strtol("99999999999999999999", 20, -1) == -1);
+}
+
+TEST(string_accessors_still_work) {
+  static char s[] = "GET /api/sensors/42?unit=7 HTTP/1.1";
+  Header ihdr;
+  Request req(&ihdr);
+  
+  req.setbuf(s);
+  req.url_format("/api/sensors/:id");
+  CHECK(req.parameter(F("id")) == "42");
+  CHECK(req.query(F("unit")) == "7");
+  CHECK(req.query(F("none")) == "");
+}
+
+TEST(value_is_decoded_once) {
+  static char s[] = "GET /files/a%2541%2Fb?q=%2541&x=1%262&y=%41 HTTP/1.1";
+  Header ihdr;
+  Request req(&ihdr);
+  RESTVIEW x;
+  RESTVIEW q;
+  RESTVIEW name;
+  
+  req.setbuf(s);
+  req.url_format("/files/:name");
+  x = req.query_view(F("x"));
+  
+  q = req.query_view(F("q"), true);
+  CHECK(std::string(q.str, q.len) == "%41");
+  q = req.query_view(F("q"), true);
+  CHECK(std::string(q.str, q.len) == "%41");
+  CHECK(req.query(F("q")) == "%41");
+  
+  // View given before decoding keeps its place, decoded '&' does not split value
+  CHECK(std::string(x.str, x.len) == "1%262");
+  x = req.query_view(F("x"), true);
+  CHECK(std::string(x.str, x.len) == "1&2");
+  CHECK(req.query(F("y")) == "%41");
+  
+  name = req.parameter_view(F("name"), true);
+  CHECK(std::string(name.str, name.len) == "a%41/b");
+  name = req.parameter_view(F("name"), true);
+  CHECK(std::string(name.str, name.len) == "a%41/b");
+}
+
+TEST(values_beyond_decode_table_are_given_as_received) {
+  static char s[] = "GET /x?a=%41&b=%42&c=%43&d=%44&e=%45 HTTP/1.1";
+  Header ihdr;
+  Request req(&ihdr);
+  const char* keys[] = { "a", "b", "c", "d" };
+  RESTVIEW v;
+  
+  req.setbuf(s);
+  for (int i = 0;i < RESTFUL_DECODED_VALUES && i < 4;++i)
+    CHECK(req.query_view(keys[i], true).len == 1);
+  v = req.query_view("e", true);
+  CHECK(std::string(v.str, v.len) == ((RESTFUL_DECODED_VALUES > 4) ? ("E") : ("%45")));
+  v = req.query_view("a");
+  CHECK(std::string(v.str, v.len) == "A");
+}
@@ -0,0 +1,121 @@
+#include "harness.h"
+
+/*
+ * Static assets in flash
+ */
+static std::string g_page;
+static std::string g_gzpage;
+
+static void page() {
+  for (int i = 0;g_page.size() < 12 * 1024;++i)
+    g_page += "<div id=\"row" + std::to_string(i) + "\">sensor</div>\n";
+  g_page.resize(12 * 1024);
+  g_gzpage = std::string("\x1f\x8b\x08\x00", 4) + std::string(2000, 'z');
+}
+
+static RESTASSET g_assets[2];
+
+static void setup() {
+  static bool done = false;
+  
+  if (done)
+    return;
+  
+  page();
+  strcpy(g_assets[0].url, "/index.html");
+  strcpy(g_assets[0].content_type, "text/html");
+  g_assets[0].data = g_page.data();
+  g_assets[0].length = g_page.size();
+  g_assets[0].gzdata = g_gzpage.data();
+  g_assets[0].gzlength = g_gzpage.size();
+  strcpy(g_assets[1].url, "/app.js");
+  strcpy(g_assets[1].content_type, "application/javascript");
+  g_assets[1].data = "console.log(1);";
+  g_assets[1].length = 15;
+  g_assets[1].gzdata = NULL;
+  g_assets[1].gzlength = 0;
+  done = true;
+}
+
+static std::string body(const std::string& s) {
+  size_t eoh = s.find("\r\n\r\n");
+  return (eoh == std::string::npos) ? ("") : (s.substr(eoh + 4));
+}
+
+TEST(asset_is_sent_with_length_and_cache_control) {
+  static char buf[512];
+  RESTful rest(buf, sizeof(buf), 64, (RESTHANDLER*)NULL, 0);
+  MockState m;
+  std::string out;
+  
+  setup();
+  rest.assets(g_assets, 2);
+  out = roundtrip(rest, m, "GET /index.html HTTP/1.1\r\n\r\n");
+  CHECK(out.find("HTTP/1.1 200 OK\r\n") == 0);
+  CHECK(out.find("Content-Type: text/html\r\n") != std::string::npos);
+  CHECK(out.find("Content-Length: 12288\r\n") != std::string::npos);
+  CHECK(out.find("Cache-Control: " RESTFUL_ASSET_CACHE_CONTROL "\r\n") != std::string::npos);
+  CHECK(out.find("Vary: Accept-Encoding\r\n") != std::string::npos);
+  CHECK(out.find("Content-Encoding") == std::string::npos);
+  CHECK(body(out) == g_page);
+}
+
+TEST(gzip_variant_is_chosen_by_accept_encoding) {
+  static char buf[512];
+  RESTful rest(buf, sizeof(buf), 64, (RESTHANDLER*)NULL, 0);
+  MockState m;
+  std::string out;
+  
+  setup();
+  rest.assets(g_assets, 2);
+  out = roundtrip(rest, m, "GET /index.html HTTP/1.1\r\nAccept-Encoding: deflate, gzip, br\r\n\r\n");
+  CHECK(out.find("Content-Encoding: gzip\r\n") != std::string::npos);
+  CHECK(out.find("Content-Length: 2004\r\n") != std::string::npos);
+  CHECK(body(out) == g_gzpage);
+  
+  // Asset without gzip variant does not vary
+  out = roundtrip(rest, m, "GET /app.js HTTP/1.1\r\nAccept-Encoding: gzip\r\n\r\n");
+  CHECK(out.find("Vary") == std::string::npos);
+  CHECK(out.find("Content-Encoding") == std::string::npos);
+  CHECK(body(out) == "console.log(1);");
+}
+
+TEST(head_of_asset_has_no_body) {
+  static char buf[512];
+  RESTful rest(buf, sizeof(buf), 64, (RESTHANDLER*)NULL, 0);
+  MockState m;
+  std::string out;
+  
+  setup();
+  rest.assets(g_assets, 2);
+  out = roundtrip(rest, m, "HEAD /index.html HTTP/1.1\r\n\r\n");
+  CHECK(out.find("Content-Length: 12288\r\n") != std::string::npos);
+  CHECK(body(out).empty());
+}
+
+TEST(asset_is_written_by_blocks) {
+  static char buf[1024];
+  RESTful rest(buf, sizeof(buf), 64, (RESTHANDLER*)NULL, 0);
+  MockState m;
+  int bufsz;
+  
+  setup();
+  rest.assets(g_assets, 2);
+  roundtrip(rest, m, "GET /index.html HTTP/1.1\r\n\r\n");
+  bufsz = rest._conn.bufsz;
+  
+  // Header shares first block, so one write more than blocks of body at most
+  CHECK(m.writes <= (12 * 1024 + bufsz - 1) / bufsz + 1);
+  CHECK(m.bytes_out == (long)m.out.size());
+}
+
+TEST(other_methods_and_urls_miss_assets) {
+  static char buf[512];
+  RESTful rest(buf, sizeof(buf), 64, (RESTHANDLER*)NULL, 0);
+  MockState m;
+  
+  setup();
+  rest.assets(g_assets, 2);
+  CHECK(roundtrip(rest, m, "GET /index.htm HTTP/1.1\r\n\r\n").find("HTTP/1.1 404 ") == 0);
+  CHECK(roundtrip(rest, m, "POST /index.html HTTP/1.1\r\n\r\n").find("HTTP/1.1 405 ") == 0);
+}
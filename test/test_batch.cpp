@@ -0,0 +1,136 @@
+#define RESTFUL_BATCH
+#include "harness.h"
+
+/*
+ * Batch endpoint
+ */
+static void sensor(Request* req, Response* res, RESTCLIENT* client) {
+  (void)client;
+  res->body(String("{\"id\":") + req->parameter(F("id")) + String(",\"unit\":\"") + req->query(F("unit")) + String("\"}"));
+}
+
+static void status(Request* req, Response* res, RESTCLIENT* client) {
+  (void)req;
+  (void)client;
+  res->constbody(F("up"));
+  res->use_constbody(true);
+}
+
+static void big(Request* req, Response* res, RESTCLIENT* client) {
+  (void)req;
+  (void)client;
+  res->body(String(std::string(300, 'b').c_str()));
+}
+
+static int produce(char* buf, int n, void* context) {
+  (void)buf;
+  (void)n;
+  (void)context;
+  return 0;
+}
+
+static void streamed(Request* req, Response* res, RESTCLIENT* client) {
+  (void)req;
+  (void)client;
+  res->stream(produce, NULL);
+}
+
+static RESTHANDLER handlers[] = {
+  {"GET", "/sensors/:id", sensor, 0},
+  {"GET", "/status", status, 0},
+  {"GET", "/big", big, 0},
+  {"GET", "/stream", streamed, 0},
+  {"GET", "/ws", status, RESTFUL_WEBSOCKET}
+};
+
+static std::string batch(const std::string& body) {
+  return "POST " RESTFUL_BATCH_URL " HTTP/1.1\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+}
+
+// Join chunks of response body
+static std::string unchunk(const std::string& s) {
+  std::string body;
+  
+  for (size_t i = s.find("\r\n\r\n") + 4;i < s.size();) {
+    size_t eol = s.find("\r\n", i);
+    long n = strtol(s.substr(i, eol - i).c_str(), NULL, 16);
+    
+    if (n == 0)
+      break;
+    body.append(s, eol + 2, n);
+    i = eol + 2 + n + 2;
+  }
+  
+  return body;
+}
+
+TEST(results_follow_calls_in_order) {
+  static char buf[1024];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 5);
+  MockState m;
+  std::string out;
+  
+  out = roundtrip(rest, m, batch("GET /sensors/4?unit=C\nGET /status\r\nGET /nothing\n\nGET /sensors/5"));
+  CHECK(out.find("HTTP/1.1 200 OK\r\n") == 0);
+  CHECK(out.find("Transfer-Encoding: chunked\r\n") != std::string::npos);
+  CHECK(unchunk(out) ==
+    "200 19\r\n{\"id\":4,\"unit\":\"C\"}\r\n"
+    "200 2\r\nup\r\n"
+    "404 0\r\n\r\n"
+    "200 18\r\n{\"id\":5,\"unit\":\"\"}\r\n");
+}
+
+TEST(result_longer_than_block_continues) {
+  static char buf[256];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 5);
+  MockState m;
+  
+  CHECK(unchunk(roundtrip(rest, m, batch("GET /big\nGET /status"))) ==
+    "200 300\r\n" + std::string(300, 'b') + "\r\n200 2\r\nup\r\n");
+}
+
+TEST(calls_that_can_not_be_batched_fail_alone) {
+  static char buf[1024];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 5);
+  MockState m;
+  
+  CHECK(unchunk(roundtrip(rest, m, batch("GET /stream\nGET /ws\nGET /" + std::string(80, 'x') + "\nGET\nGET /status"))) ==
+    "501 0\r\n\r\n501 0\r\n\r\n414 0\r\n\r\n400 0\r\n\r\n200 2\r\nup\r\n");
+}
+
+TEST(body_arriving_later_is_collected) {
+  static char buf[1024];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 5);
+  MockState m;
+  MockClient client(&m);
+  std::string s = batch("GET /status\nGET /sensors/1\nGET /status");
+  
+  for (size_t i = 0;i < s.size();i += 9)
+    m.push(s.substr(i, 9));
+  m.segmented = true;
+  m.halfclosed = true;
+  rest.loop(client);
+  CHECK(count(unchunk(m.out), "200 ") == 3);
+}
+
+TEST(body_larger_than_buffer_is_refused) {
+  static char buf[256];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 5);
+  MockState m;
+  std::string calls;
+  
+  for (int i = 0;i < 30;++i)
+    calls += "GET /status\n";
+  CHECK(roundtrip(rest, m, batch(calls)).find("HTTP/1.1 413 ") == 0);
+}
+
+TEST(batch_is_one_response_on_connection) {
+  static char buf[1024];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 5);
+  MockState m;
+  
+  rest.keepalive_requests(10);
+  roundtrip(rest, m, batch("GET /status\nGET /status") + "GET /status HTTP/1.1\r\n\r\n");
+  CHECK(count(m.out, "HTTP/1.1 200 OK") == 2);
+  CHECK(m.out.substr(m.out.size() - 2) == "up");
+}
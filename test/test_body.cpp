@@ -0,0 +1,237 @@
+#include "harness.h"
+
+/*
+ * Streaming request body
+ */
+static std::string g_body;
+static std::vector<int> g_reads;
+static int g_last;
+static MockState* g_peer;
+
+static void upload(Request* req, Response* res, RESTCLIENT* client) {
+  char buf[64];
+  int n;
+  
+  (void)client;
+  g_body.clear();
+  g_reads.clear();
+  while ((n = req->read(buf, sizeof(buf))) > 0) {
+    g_body.append(buf, n);
+    g_reads.push_back(n);
+  }
+  g_last = n;
+  res->body(F("stored"));
+}
+
+static bool collect(const char* s, int n, void* context) {
+  ((std::string*)context)->append(s, n);
+  return true;
+}
+
+static void blocks(Request* req, Response* res, RESTCLIENT* client) {
+  char buf[16];
+  
+  (void)client;
+  g_body.clear();
+  g_last = req->receive(buf, sizeof(buf), collect, &g_body);
+  res->body(F("stored"));
+}
+
+// Peer sends next byte only after each one is read
+static void drip(Request* req, Response* res, RESTCLIENT* client) {
+  char c;
+  
+  (void)client;
+  g_body.clear();
+  while ((g_last = req->read(&c, 1)) > 0) {
+    g_body += c;
+    usleep(5000);
+    g_peer->release();
+  }
+  res->body(F("stored"));
+}
+
+static void ignore(Request* req, Response* res, RESTCLIENT* client) {
+  (void)req;
+  (void)client;
+  res->body(F("ignored"));
+}
+
+static RESTHANDLER handlers[] = {
+  {"POST", "/upload", upload},
+  {"POST", "/blocks", blocks},
+  {"POST", "/ignore", ignore},
+  {"GET", "/next", ignore},
+  {"POST", "/drip", drip}
+};
+
+static std::string payload(int n) {
+  std::string s;
+  
+  for (int i = 0;i < n;++i)
+    s += (char)('a' + (i * 7) % 26);
+  return s;
+}
+
+static std::string post(const char* url, int length) {
+  return std::string("POST ") + url + " HTTP/1.1\r\nContent-Length: " + std::to_string(length) + "\r\n\r\n";
+}
+
+TEST(body_arrives_in_uneven_fragments) {
+  static char buf[256];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 5);
+  MockState m;
+  MockClient client(&m);
+  std::string body = payload(1000);
+  size_t sizes[] = { 1, 13, 200, 2, 64, 65, 300 };
+  size_t pos = 0;
+  
+  m.segmented = true;
+  m.push(post("/upload", body.size()) + body.substr(0, 5));
+  pos = 5;
+  for (int i = 0;pos < body.size();i = (i + 1) % 7) {
+    m.push(body.substr(pos, sizes[i]));
+    pos += sizes[i];
+  }
+  m.halfclosed = true;
+  rest.loop(client);
+  
+  CHECK(g_body == body);
+  CHECK(g_last == 0);
+  CHECK(g_reads[0] == 5);
+  CHECK(*std::max_element(g_reads.begin(), g_reads.end()) == 64);
+  CHECK(m.out.find("stored") != std::string::npos);
+}
+
+TEST(declared_length_is_enforced) {
+  static char buf[512];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 5);
+  MockState m;
+  
+  rest.keepalive_requests(10);
+  roundtrip(rest, m, post("/upload", 10) + "0123456789GET /next HTTP/1.1\r\n\r\n");
+  CHECK(g_body == "0123456789");
+  CHECK(count(m.out, "200 OK") == 2);
+  CHECK(m.out.find("ignored") != std::string::npos);
+}
+
+TEST(body_passed_to_callback_by_blocks) {
+  static char buf[256];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 5);
+  MockState m;
+  std::string body = payload(777);
+  
+  m.segmented = true;
+  roundtrip(rest, m, post("/blocks", body.size()) + body);
+  CHECK(g_last == 1);
+  CHECK(g_body == body);
+}
+
+TEST(stalled_body_times_out) {
+  static char buf[256];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 5);
+  MockState m;
+  MockClient client(&m);
+  unsigned long ts = millis();
+  
+  rest.body_timeout(30);
+  m.push(post("/upload", 100) + "abc");
+  rest.loop(client);
+  CHECK(g_body == "abc");
+  CHECK(g_last == -1);
+  CHECK(millis() - ts >= 30);
+}
+
+TEST(trickled_body_is_read_until_deadline) {
+  static char buf[256];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 5);
+  MockState m;
+  MockClient client(&m);
+  unsigned long ts = millis();
+  
+  // Each byte comes well within timeout, whole body does not
+  g_peer = &m;
+  rest.body_timeout(50);
+  m.push(post("/drip", 100));
+  m.trickle(payload(100));
+  m.hold(2);
+  rest.loop(client);
+  CHECK(g_last == -1);
+  CHECK(g_body.size() >= 5);
+  CHECK(g_body.size() < 20);
+  CHECK(millis() - ts >= 50);
+  CHECK(millis() - ts < 150);
+}
+
+TEST(unread_body_is_dropped_across_polls) {
+  static char buf[512];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 5);
+  MockState m;
+  MockClient client(&m);
+  std::string body = payload(200);
+  
+  rest.keepalive_requests(10);
+  m.push(post("/ignore", body.size()) + body.substr(0, 10));
+  for (size_t i = 10;i < body.size();i += 19)
+    m.push(body.substr(i, 19));
+  m.push("GET /next HTTP/1.1\r\n\r\n");
+  m.hold(1);
+  m.segmented = true;
+  
+  // Response goes out before body arrives, rest of it is dropped by later polls
+  CHECK(rest.poll(client) == RESTFUL_DISPATCHED);
+  CHECK(count(m.out, "Connection: keep-alive") == 1);
+  for (size_t i = 1;i < m.in.size() - 1;++i) {
+    m.release();
+    CHECK(rest.poll(client) == RESTFUL_NEED_MORE);
+  }
+  m.release();
+  CHECK(rest.poll(client) == RESTFUL_DISPATCHED);
+  CHECK(count(m.out, "ignored") == 2);
+}
+
+TEST(trickled_body_can_not_extend_deadline) {
+  static char buf[512];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 5);
+  MockState m;
+  MockClient client(&m);
+  unsigned long ts;
+  unsigned long worst = 0;
+  int r;
+  
+  rest.keepalive_requests(10);
+  rest.body_timeout(50);
+  m.push(post("/ignore", 100));
+  m.trickle(payload(100));
+  m.hold(1);
+  CHECK(rest.poll(client) == RESTFUL_DISPATCHED);
+  
+  ts = millis();
+  do {
+    unsigned long t = millis();
+    
+    m.release();
+    r = rest.poll(client);
+    worst = max(worst, millis() - t);
+    usleep(5000);
+  } while (r == RESTFUL_NEED_MORE);
+  
+  CHECK(r == RESTFUL_CLOSED);
+  CHECK(millis() - ts >= 50);
+  CHECK(millis() - ts < 200);
+  CHECK(worst < 10);
+}
+
+TEST(loop_closes_instead_of_waiting_for_body) {
+  static char buf[512];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 5);
+  MockState m;
+  MockClient client(&m);
+  unsigned long ts = millis();
+  
+  rest.keepalive_requests(10);
+  m.push(post("/ignore", 100));
+  rest.loop(client);
+  CHECK(millis() - ts < 20);
+  CHECK(m.out.find("Connection: close") != std::string::npos);
+}
@@ -0,0 +1,153 @@
+#include "harness.h"
+
+/*
+ * Response cache
+ */
+static int g_calls = 0;
+
+static void reading(Request* req, Response* res, RESTCLIENT* client) {
+  (void)client;
+  g_calls++;
+  res->header()->set(F("Content-Type"), F("application/json"));
+  res->body(String("{\"temp\":21.5,\"q\":\"") + req->query(F("q")) + String("\"}"));
+}
+
+static RESTHANDLER handlers[] = {
+  {"GET", "/reading", reading, RESTFUL_CACHEABLE},
+  {"GET", "/live", reading, 0}
+};
+
+static std::string etag(const std::string& s) {
+  size_t i = s.find("ETag: ");
+  return (i == std::string::npos) ? ("") : (s.substr(i + 6, 10));
+}
+
+static std::string body(const std::string& s) {
+  return s.substr(s.find("\r\n\r\n") + 4);
+}
+
+TEST(hit_skips_handler) {
+  static char buf[1024];
+  static char cache[512];
+  RESTful rest(buf, sizeof(buf), 128, handlers, 2);
+  MockState m;
+  std::string first;
+  std::string second;
+  
+  rest.cache(cache, sizeof(cache));
+  g_calls = 0;
+  first = roundtrip(rest, m, "GET /reading HTTP/1.1\r\n\r\n");
+  second = roundtrip(rest, m, "GET /reading HTTP/1.1\r\n\r\n");
+  CHECK(g_calls == 1);
+  CHECK(first == second);
+  CHECK(second.find("HTTP/1.1 200 OK\r\n") == 0);
+  CHECK(second.find("Content-Type: application/json\r\n") != std::string::npos);
+  CHECK(etag(second).size() == 10);
+  CHECK(body(second) == "{\"temp\":21.5,\"q\":\"\"}");
+  
+  // Query is part of key, handler without flag is never cached
+  CHECK(body(roundtrip(rest, m, "GET /reading?q=1 HTTP/1.1\r\n\r\n")) == "{\"temp\":21.5,\"q\":\"1\"}");
+  CHECK(g_calls == 2);
+  roundtrip(rest, m, "GET /live HTTP/1.1\r\n\r\n");
+  roundtrip(rest, m, "GET /live HTTP/1.1\r\n\r\n");
+  CHECK(g_calls == 4);
+}
+
+TEST(matching_tag_gets_304) {
+  static char buf[1024];
+  static char cache[512];
+  RESTful rest(buf, sizeof(buf), 128, handlers, 2);
+  MockState m;
+  std::string tag;
+  std::string out;
+  
+  rest.cache(cache, sizeof(cache));
+  tag = etag(roundtrip(rest, m, "GET /reading HTTP/1.1\r\n\r\n"));
+  
+  out = roundtrip(rest, m, "GET /reading HTTP/1.1\r\nIf-None-Match: W/\"0\", " + tag + "\r\n\r\n");
+  CHECK(out.find("HTTP/1.1 304 Not Modified\r\n") == 0);
+  CHECK(etag(out) == tag);
+  CHECK(body(out) == "");
+  CHECK(roundtrip(rest, m, "GET /reading HTTP/1.1\r\nIf-None-Match: *\r\n\r\n").find("HTTP/1.1 304 ") == 0);
+  
+  out = roundtrip(rest, m, "GET /reading HTTP/1.1\r\nIf-None-Match: \"00000000\"\r\n\r\n");
+  CHECK(out.find("HTTP/1.1 200 OK\r\n") == 0);
+  CHECK(body(out) == "{\"temp\":21.5,\"q\":\"\"}");
+}
+
+TEST(pipelined_requests_are_revalidated) {
+  static char buf[1024];
+  static char cache[512];
+  RESTful rest(buf, sizeof(buf), 128, handlers, 2);
+  MockState m;
+  std::string tag;
+  std::string s;
+  
+  rest.cache(cache, sizeof(cache));
+  rest.keepalive_requests(10);
+  tag = etag(roundtrip(rest, m, "GET /reading HTTP/1.1\r\n\r\n"));
+  for (int i = 0;i < 3;++i)
+    s += "GET /reading HTTP/1.1\r\nIf-None-Match: " + tag + "\r\n\r\n";
+  roundtrip(rest, m, s + "GET /reading HTTP/1.1\r\n\r\n");
+  CHECK(count(m.out, "HTTP/1.1 304 Not Modified\r\n") == 3);
+  CHECK(count(m.out, "HTTP/1.1 200 OK\r\n") == 1);
+}
+
+TEST(head_is_served_from_cache) {
+  static char buf[1024];
+  static char cache[512];
+  RESTful rest(buf, sizeof(buf), 128, handlers, 2);
+  MockState m;
+  std::string out;
+  
+  rest.cache(cache, sizeof(cache));
+  g_calls = 0;
+  roundtrip(rest, m, "GET /reading HTTP/1.1\r\n\r\n");
+  out = roundtrip(rest, m, "HEAD /reading HTTP/1.1\r\n\r\n");
+  CHECK(g_calls == 1);
+  CHECK(out.find("HTTP/1.1 200 OK\r\n") == 0);
+  CHECK(out.find("Content-Length: 20\r\n") != std::string::npos);
+  CHECK(etag(out).size() == 10);
+  CHECK(body(out) == "");
+}
+
+TEST(invalidation_runs_handler_and_changes_tag) {
+  static char buf[1024];
+  static char cache[512];
+  RESTful rest(buf, sizeof(buf), 128, handlers, 2);
+  MockState m;
+  std::string tag;
+  std::string out;
+  
+  rest.cache(cache, sizeof(cache));
+  g_calls = 0;
+  tag = etag(roundtrip(rest, m, "GET /reading HTTP/1.1\r\n\r\n"));
+  
+  rest.invalidate();
+  CHECK(rest.cache_version() == 1);
+  out = roundtrip(rest, m, "GET /reading HTTP/1.1\r\nIf-None-Match: " + tag + "\r\n\r\n");
+  CHECK(g_calls == 2);
+  CHECK(out.find("HTTP/1.1 200 OK\r\n") == 0);
+  CHECK(etag(out).size() == 10);
+  CHECK(etag(out) != tag);
+  CHECK(body(out) == "{\"temp\":21.5,\"q\":\"\"}");
+  
+  roundtrip(rest, m, "GET /reading HTTP/1.1\r\n\r\n");
+  CHECK(g_calls == 2);
+}
+
+TEST(full_cache_starts_over) {
+  static char buf[1024];
+  static char cache[128];
+  RESTful rest(buf, sizeof(buf), 128, handlers, 2);
+  MockState m;
+  
+  rest.cache(cache, sizeof(cache));
+  g_calls = 0;
+  roundtrip(rest, m, "GET /reading?q=1 HTTP/1.1\r\n\r\n");
+  roundtrip(rest, m, "GET /reading?q=2 HTTP/1.1\r\n\r\n");
+  roundtrip(rest, m, "GET /reading?q=2 HTTP/1.1\r\n\r\n");
+  CHECK(g_calls == 2);
+  roundtrip(rest, m, "GET /reading?q=1 HTTP/1.1\r\n\r\n");
+  CHECK(g_calls == 3);
+}
@@ -0,0 +1,156 @@
+#include "harness.h"
+
+/*
+ * Deferred handlers
+ * 
+ * Fake sensor needs 50 ms for conversion, handler is called again until reading is ready.
+ */
+static const unsigned long CONVERSION = 50;
+static unsigned long g_started;
+static unsigned long g_timeout;
+static int g_calls;
+
+static void sensor(Request* req, Response* res, RESTCLIENT* client) {
+  (void)client;
+  g_calls++;
+  if (req->state() == 0) {
+    g_started = millis();
+    res->defer(g_timeout, 1);
+    return;
+  }
+  
+  if (millis() - g_started < CONVERSION) {
+    res->defer(g_timeout, 1);
+    return;
+  }
+  
+  res->body(String("sensor ") + req->parameter(F("id")) + String(" unit ") +
+    String(req->header()->get_view(F("X-Unit")).str));
+}
+
+static void fast(Request* req, Response* res, RESTCLIENT* client) {
+  (void)req;
+  (void)client;
+  res->body(F("fast"));
+}
+
+static RESTHANDLER handlers[] = {
+  {"GET", "/sensors/:id", sensor},
+  {"GET", "/fast", fast}
+};
+
+struct Fixture {
+  char buf[2048];
+  RESTCONNECTION conn[4];
+  RESTDEFERRED slots[2];
+  RESTful rest;
+  
+  Fixture() : rest(buf, sizeof(buf), 64, handlers, 2) {
+    rest.connections(conn, 4);
+    rest.deferrals(slots, 2);
+    rest.keepalive_requests(10);
+    g_timeout = 1000;
+    g_calls = 0;
+  }
+};
+
+TEST(other_requests_are_not_delayed) {
+  Fixture f;
+  MockState slow;
+  MockState quick;
+  MockClient sc(&slow);
+  MockClient qc(&quick);
+  unsigned long ts = millis();
+  unsigned long answered = 0;
+  
+  slow.push("GET /sensors/7 HTTP/1.1\r\nX-Unit: C\r\n\r\n");
+  quick.push("GET /fast HTTP/1.1\r\n\r\n");
+  CHECK(f.rest.accept(sc));
+  CHECK(f.rest.accept(qc));
+  
+  while (slow.out.empty() && millis() - ts < 1000) {
+    f.rest.service();
+    if (answered == 0 && !quick.out.empty())
+      answered = millis() - ts;
+  }
+  
+  CHECK(quick.out.find("\r\n\r\nfast") != std::string::npos);
+  CHECK(answered < 10);
+  CHECK(slow.out.find("HTTP/1.1 200 OK") == 0);
+  CHECK(slow.out.find("\r\n\r\nsensor 7 unit C") != std::string::npos);
+  CHECK(millis() - ts >= CONVERSION);
+  CHECK(g_calls > 2);
+}
+
+TEST(poll_returns_while_handler_is_pending) {
+  Fixture f;
+  MockState m;
+  MockClient client(&m);
+  unsigned long worst = 0;
+  int r;
+  
+  m.push("GET /sensors/3 HTTP/1.1\r\nX-Unit: F\r\n\r\nGET /fast HTTP/1.1\r\n\r\n");
+  do {
+    unsigned long ts = millis();
+    
+    r = f.rest.poll(client);
+    worst = max(worst, millis() - ts);
+  } while (r == RESTFUL_NEED_MORE);
+  
+  CHECK(r == RESTFUL_DISPATCHED);
+  CHECK(worst < 5);
+  CHECK(m.out.find("sensor 3 unit F") != std::string::npos);
+  
+  // Pipelined request is answered after deferred one
+  while (f.rest.poll(client) == RESTFUL_NEED_MORE);
+  CHECK(m.out.find("sensor 3") < m.out.find("\r\n\r\nfast"));
+}
+
+TEST(deadline_gives_504) {
+  Fixture f;
+  MockState m;
+  MockClient client(&m);
+  unsigned long ts = millis();
+  
+  g_timeout = 20;
+  m.push("GET /sensors/1 HTTP/1.1\r\nX-Unit: C\r\n\r\n");
+  while (f.rest.poll(client) == RESTFUL_NEED_MORE);
+  CHECK(m.out.find("HTTP/1.1 504 ") == 0);
+  CHECK(millis() - ts >= 20);
+  CHECK(millis() - ts < CONVERSION);
+}
+
+TEST(handler_is_awaited_without_free_slot_or_poll) {
+  Fixture f;
+  MockState m[3];
+  MockClient c[3] = { MockClient(&m[0]), MockClient(&m[1]), MockClient(&m[2]) };
+  unsigned long ts;
+  
+  // Third request finds both slots taken and is completed in place
+  for (int i = 0;i < 3;++i) {
+    m[i].push("GET /sensors/" + std::to_string(i) + " HTTP/1.1\r\nX-Unit: C\r\n\r\n");
+    CHECK(f.rest.accept(c[i]));
+  }
+  f.rest.service();
+  CHECK(m[0].out.empty() && m[1].out.empty());
+  CHECK(m[2].out.find("sensor 2") != std::string::npos);
+  
+  // Loop has nothing to resume it, so it waits for handler
+  ts = millis();
+  CHECK(roundtrip(f.rest, m[0], "GET /sensors/9 HTTP/1.1\r\nX-Unit: K\r\n\r\n").find("sensor 9 unit K") != std::string::npos);
+  CHECK(millis() - ts >= CONVERSION);
+}
+
+TEST(slot_is_freed_when_peer_leaves) {
+  Fixture f;
+  MockState m;
+  MockClient client(&m);
+  
+  m.push("GET /sensors/5 HTTP/1.1\r\nX-Unit: C\r\n\r\n");
+  CHECK(f.rest.poll(client) == RESTFUL_NEED_MORE);
+  CHECK(f.slots[0].used || f.slots[1].used);
+  
+  m.open = false;
+  CHECK(f.rest.poll(client) == RESTFUL_CLOSED);
+  CHECK(!f.slots[0].used && !f.slots[1].used);
+}
@@ -0,0 +1,126 @@
+#include "harness.h"
+
+/*
+ * Server-Sent Events
+ */
+static void live(Request* req, Response* res, RESTCLIENT* client) {
+  (void)req;
+  (void)res;
+  (void)client;
+}
+
+static void full(Request* req, Response* res, RESTCLIENT* client) {
+  (void)req;
+  (void)client;
+  res->status(HTTP_404_NOT_FOUND);
+}
+
+static RESTHANDLER handlers[] = {
+  {"GET", "/events", live, RESTFUL_EVENTSTREAM},
+  {"GET", "/gone", full, RESTFUL_EVENTSTREAM}
+};
+
+struct Fixture {
+  char buf[512];
+  char evbuf[128];
+  RESTSUBSCRIBER subs[4];
+  RESTful rest;
+  MockState m[5];
+  
+  Fixture() : rest(buf, sizeof(buf), 64, handlers, 2) {
+    rest.subscribers(subs, 4, evbuf, sizeof(evbuf));
+  }
+  
+  int join(int i) {
+    MockClient client(&this->m[i]);
+    int r;
+    
+    this->m[i].push("GET /events HTTP/1.1\r\nAccept: text/event-stream\r\n\r\n");
+    r = this->rest.loop(client);
+    this->m[i].out.clear();
+    this->m[i].clear();
+    return r;
+  }
+};
+
+TEST(subscriber_gets_stream_header_and_stays_open) {
+  Fixture f;
+  MockClient client(&f.m[0]);
+  
+  f.m[0].push("GET /events HTTP/1.1\r\n\r\n");
+  CHECK(f.rest.loop(client) == RESTFUL_UPGRADED);
+  CHECK(f.m[0].out.find("HTTP/1.1 200 OK\r\n") == 0);
+  CHECK(f.m[0].out.find("Content-Type: text/event-stream\r\n") != std::string::npos);
+  CHECK(f.m[0].out.find("Content-Length") == std::string::npos);
+  CHECK(f.m[0].stops == 0);
+  CHECK(f.rest.subscriber_count() == 1);
+}
+
+TEST(event_is_formatted_once_for_all) {
+  Fixture f;
+  
+  for (int i = 0;i < 3;++i)
+    CHECK(f.join(i) == RESTFUL_UPGRADED);
+  
+  CHECK(f.rest.broadcast("reading", "21.5\n40%") == 3);
+  for (int i = 0;i < 3;++i) {
+    CHECK(f.m[i].out == "event: reading\ndata: 21.5\ndata: 40%\n\n");
+    CHECK(f.m[i].writes == 1);
+  }
+  
+  CHECK(f.rest.broadcast(NULL, "x") == 3);
+  CHECK(f.m[0].out.substr(f.m[0].out.size() - 9) == "data: x\n\n");
+}
+
+TEST(table_is_bounded) {
+  Fixture f;
+  MockClient client(&f.m[4]);
+  
+  for (int i = 0;i < 4;++i)
+    f.join(i);
+  
+  f.m[4].push("GET /events HTTP/1.1\r\n\r\n");
+  CHECK(f.rest.loop(client) == RESTFUL_DISPATCHED);
+  CHECK(f.m[4].out.find("HTTP/1.1 503 ") == 0);
+  CHECK(f.rest.subscriber_count() == 4);
+}
+
+TEST(refused_route_does_not_subscribe) {
+  Fixture f;
+  MockClient client(&f.m[0]);
+  
+  f.m[0].push("GET /gone HTTP/1.1\r\n\r\n");
+  CHECK(f.rest.loop(client) == RESTFUL_DISPATCHED);
+  CHECK(f.m[0].out.find("HTTP/1.1 404 ") == 0);
+  CHECK(f.rest.subscriber_count() == 0);
+}
+
+TEST(dead_refusing_and_slow_subscribers_are_evicted) {
+  Fixture f;
+  
+  for (int i = 0;i < 4;++i)
+    f.join(i);
+  f.rest.event_timeout(20);
+  
+  f.m[1].open = false;
+  f.m[2].maxwrite = 5;
+  f.m[3].writedelay = 30000;
+  CHECK(f.rest.broadcast("tick", "1") == 1);
+  CHECK(f.rest.subscriber_count() == 1);
+  CHECK(f.m[2].stops == 1);
+  CHECK(f.m[3].stops == 1);
+  
+  // Freed slots take new subscribers
+  f.m[1].reset();
+  CHECK(f.join(1) == RESTFUL_UPGRADED);
+  CHECK(f.rest.broadcast("tick", "2") == 2);
+}
+
+TEST(oversized_event_is_refused) {
+  Fixture f;
+  
+  f.join(0);
+  CHECK(f.rest.broadcast("big", std::string(200, 'x').c_str()) == -1);
+  CHECK(f.m[0].out.empty());
+  CHECK(f.rest.subscriber_count() == 1);
+}
@@ -0,0 +1,56 @@
+#include "harness.h"
+
+/*
+ * Indexed header fields
+ */
+static std::string g_values;
+
+static std::string text(const RESTVIEW& v) {
+  return (v.str != NULL) ? (std::string(v.str, v.len)) : (std::string("(none)"));
+}
+
+static void show(Request* req, Response* res, RESTCLIENT* client) {
+  (void)res;
+  (void)client;
+  g_values = text(req->header()->get_view(F("host"))) + "|" +
+    text(req->header()->get_view(F("ACCEPT-ENCODING"))) + "|" +
+    text(req->header()->get_view(F("Sec-Fetch-Mode"))) + "|" +
+    text(req->header()->get_view(F("X-Missing"))) + "|" +
+    req->header()->get(F("user-agent")).c_str();
+}
+
+static RESTHANDLER handlers[] = {
+  {"GET", "/api/sensors/:id", show}
+};
+
+TEST(keys_match_case_insensitively) {
+  static char buf[1024];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 1);
+  MockState m;
+  
+  roundtrip(rest, m, corpus("chrome.http"));
+  CHECK(g_values == "192.168.1.177|gzip, deflate|navigate|(none)|"
+    "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36");
+}
+
+TEST(values_are_trimmed) {
+  static char buf[512];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 1);
+  MockState m;
+  
+  roundtrip(rest, m, "GET /api/sensors/1 HTTP/1.1\r\nHOST:\t a \r\nAccept-Encoding:\r\n\r\n");
+  CHECK(g_values.find("a||(none)|(none)|") == 0);
+}
+
+TEST(header_beyond_table_is_scanned) {
+  static char buf[2048];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 1);
+  MockState m;
+  std::string s = "GET /api/sensors/1 HTTP/1.1\r\n";
+  
+  for (int i = 0;i < RESTFUL_HEADER_FIELDS + 4;++i)
+    s += "X-Field-" + std::to_string(i) + ": " + std::to_string(i) + "\r\n";
+  s += "Host: late\r\n\r\n";
+  roundtrip(rest, m, s);
+  CHECK(g_values.find("late|") == 0);
+}
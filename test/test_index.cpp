@@ -0,0 +1,93 @@
+#include "harness.h"
+
+/*
+ * Route index
+ * 
+ * Index has to pick the same handler as linear scan of array.
+ */
+static void cb(Request* req, Response* res, RESTCLIENT* client) {
+  (void)req;
+  (void)res;
+  (void)client;
+}
+
+static RESTHANDLER handlers[] = {
+  {"GET", "/users/:id", cb},
+  {"GET", "/users/me", cb},
+  {"GET", "/users/me/posts", cb},
+  {"GET", "/users/:id/posts", cb},
+  {"GET", "/users/:id/posts/:post", cb},
+  {"GET", "/users/me/posts/latest", cb},
+  {"POST", "/users/me", cb},
+  {"POST", "/users/:id", cb},
+  {"GET", "/:any/status", cb},
+  {"GET", "/device/status", cb},
+  {"GET", "/device/:name", cb},
+  {"GET", "/", cb}
+};
+
+static const char* urls[] = {
+  "/users/me", "/users/42", "/users/me/posts", "/users/42/posts", "/users/me/posts/latest",
+  "/users/42/posts/latest", "/users/me/posts/7", "/users/", "/users", "/device/status",
+  "/device/led", "/x/status", "/", "/nothing/here", "/users/me/posts/latest/more"
+};
+
+static int linear(const char* method, const char* url) {
+  char s[64];
+  Header ihdr;
+  Header ohdr;
+  Request req(&ihdr);
+  Response res(&ohdr);
+  RESTHANDLER* h;
+  
+  strcpy(s, url);
+  req._url = s;
+  req._failed = false;
+  h = RESTful::findhdlr(handlers, sizeof(handlers) / sizeof(handlers[0]), method, &req, &res);
+  return (h != NULL) ? (int)(h - handlers) : (-1);
+}
+
+static int indexed(const RESTNODE* idx, const char* method, const char* url) {
+  char s[64];
+  Header ihdr;
+  Header ohdr;
+  Request req(&ihdr);
+  Response res(&ohdr);
+  RESTHANDLER* h;
+  
+  strcpy(s, url);
+  req._url = s;
+  req._failed = false;
+  h = RESTful::findidx(idx, handlers, method, &req, &res);
+  return (h != NULL) ? (int)(h - handlers) : (-1);
+}
+
+TEST(index_follows_array_order) {
+  static RESTNODE idx[64];
+  int n = sizeof(handlers) / sizeof(handlers[0]);
+  
+  CHECK(RESTful::buildidx(idx, 64, handlers, n));
+  for (size_t i = 0;i < sizeof(urls) / sizeof(urls[0]);++i) {
+    CHECK(indexed(idx, "GET", urls[i]) == linear("GET", urls[i]));
+    CHECK(indexed(idx, "POST", urls[i]) == linear("POST", urls[i]));
+  }
+}
+
+TEST(param_declared_first_wins) {
+  static RESTNODE idx[64];
+  
+  CHECK(RESTful::buildidx(idx, 64, handlers, sizeof(handlers) / sizeof(handlers[0])));
+  CHECK(indexed(idx, "GET", "/users/me") == 0);
+  CHECK(indexed(idx, "POST", "/users/me") == 6);
+  CHECK(indexed(idx, "GET", "/device/status") == 8);
+}
+
+TEST(small_index_falls_back_to_scan) {
+  static char buf[512];
+  static RESTNODE idx[4];
+  RESTful rest(buf, sizeof(buf), 64, handlers, sizeof(handlers) / sizeof(handlers[0]), idx, 4);
+  MockState m;
+  
+  CHECK(rest._idx == NULL);
+  CHECK(roundtrip(rest, m, "GET /users/me/posts HTTP/1.1\r\n\r\n").find("200 OK") != std::string::npos);
+}
@@ -0,0 +1,95 @@
+#include "harness.h"
+
+/*
+ * Persistent connection
+ */
+static void ok(Request* req, Response* res, RESTCLIENT* client) {
+  (void)client;
+  res->body(req->url());
+}
+
+static RESTHANDLER handlers[] = {
+  {"GET", "/:name", ok}
+};
+
+static std::string get(const char* url, const char* version, const char* connection) {
+  std::string s = std::string("GET ") + url + " " + version + "\r\nHost: x\r\n";
+  
+  if (connection != NULL)
+    s += std::string("Connection: ") + connection + "\r\n";
+  return s + "\r\n";
+}
+
+TEST(requests_share_connection) {
+  static char buf[512];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 1);
+  MockState m;
+  MockClient client(&m);
+  
+  rest.keepalive_requests(10);
+  m.push(get("/a", "HTTP/1.1", NULL));
+  m.push(get("/b", "HTTP/1.1", NULL));
+  m.push(get("/c", "HTTP/1.1", "close"));
+  m.push(get("/d", "HTTP/1.1", NULL));
+  m.hold(1);
+  
+  // Next request arrives while connection is idle
+  CHECK(rest.poll(client) == RESTFUL_DISPATCHED);
+  m.release(3);
+  CHECK(rest.poll(client) == RESTFUL_DISPATCHED);
+  CHECK(rest.poll(client) == RESTFUL_DISPATCHED);
+  CHECK(count(m.out, "Connection: keep-alive\r\n") == 2);
+  CHECK(count(m.out, "Connection: close\r\n") == 1);
+  CHECK(count(m.out, "Content-Length: 2\r\n") == 3);
+  CHECK(m.out.find("/d") == std::string::npos);
+  CHECK(m.stops == 1);
+}
+
+TEST(http10_closes_unless_asked) {
+  static char buf[512];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 1);
+  MockState m;
+  
+  rest.keepalive_requests(10);
+  roundtrip(rest, m, get("/a", "HTTP/1.0", NULL) + get("/b", "HTTP/1.0", NULL));
+  CHECK(count(m.out, "200 OK") == 1);
+  CHECK(m.out.find("Connection: close\r\n") != std::string::npos);
+  
+  roundtrip(rest, m, get("/a", "HTTP/1.0", "keep-alive") + get("/b", "HTTP/1.0", NULL));
+  CHECK(count(m.out, "200 OK") == 2);
+  CHECK(m.out.find("Connection: keep-alive\r\n") != std::string::npos);
+}
+
+TEST(request_cap_closes_connection) {
+  static char buf[512];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 1);
+  MockState m;
+  std::string s;
+  
+  rest.keepalive_requests(3);
+  for (int i = 0;i < 5;++i)
+    s += get("/a", "HTTP/1.1", NULL);
+  roundtrip(rest, m, s);
+  CHECK(count(m.out, "200 OK") == 3);
+  CHECK(count(m.out, "Connection: close\r\n") == 1);
+}
+
+TEST(idle_connection_times_out) {
+  static char buf[512];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 1);
+  MockState m;
+  MockClient client(&m);
+  unsigned long ts;
+  int r;
+  
+  rest.keepalive_requests(10);
+  rest.keepalive_timeout(30);
+  m.push(get("/a", "HTTP/1.1", NULL));
+  CHECK(rest.poll(client) == RESTFUL_DISPATCHED);
+  ts = millis();
+  while ((r = rest.poll(client)) == RESTFUL_NEED_MORE)
+    ;
+  CHECK(r == RESTFUL_CLOSED);
+  CHECK(millis() - ts >= 30);
+  CHECK(m.stops == 1);
+}
@@ -0,0 +1,211 @@
+#define RESTFUL_METRICS
+#include "harness.h"
+
+#include <unistd.h>
+
+/*
+ * Metrics
+ */
+static void hello(Request* req, Response* res, RESTCLIENT* client) {
+  (void)req;
+  (void)client;
+  res->body(F("hello"));
+}
+
+static void broken(Request* req, Response* res, RESTCLIENT* client) {
+  (void)req;
+  (void)client;
+  res->status(HTTP_500_INTERNAL_SERVER_ERROR);
+}
+
+static void denied(Request* req, Response* res, RESTCLIENT* client) {
+  (void)req;
+  (void)client;
+  res->status(HTTP_403_FORBIDDEN);
+}
+
+static void slow(Request* req, Response* res, RESTCLIENT* client) {
+  char buf[16];
+  
+  (void)client;
+  while (req->read(buf, sizeof(buf)) > 0);
+  usleep(6000);
+  res->body(F("late"));
+}
+
+static RESTHANDLER handlers[] = {
+  {"GET", "/hello", hello},
+  {"GET", "/broken", broken},
+  {"GET", "/denied", denied},
+  {"POST", "/slow", slow}
+};
+
+// Value of metric line starting with given name and labels
+static long metric(const std::string& s, const std::string& name) {
+  size_t i = s.find("\n" + name + " ");
+  
+  if (i == std::string::npos)
+    return -1;
+  return atol(s.c_str() + i + name.size() + 2);
+}
+
+static std::string scrape(RESTful& rest) {
+  MockState m;
+  std::string out = roundtrip(rest, m, "GET /metrics HTTP/1.1\r\n\r\n");
+  size_t eoh = out.find("\r\n\r\n");
+  std::string body;
+  
+  // Chunks are joined into plain text
+  for (size_t i = eoh + 4;i < out.size();) {
+    size_t eol = out.find("\r\n", i);
+    long n = strtol(out.substr(i, eol - i).c_str(), NULL, 16);
+    
+    if (n == 0)
+      break;
+    body.append(out, eol + 2, n);
+    i = eol + 2 + n + 2;
+  }
+  
+  return "\n" + body;
+}
+
+TEST(routes_are_counted_by_status) {
+  static char buf[512];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 4);
+  MockState m;
+  std::string s;
+  
+  for (int i = 0;i < 3;++i)
+    roundtrip(rest, m, "GET /hello HTTP/1.1\r\n\r\n");
+  roundtrip(rest, m, "GET /broken HTTP/1.1\r\n\r\n");
+  roundtrip(rest, m, "GET /denied HTTP/1.1\r\n\r\n");
+  roundtrip(rest, m, "GET /missing HTTP/1.1\r\n\r\n");
+  
+  s = scrape(rest);
+  CHECK(metric(s, "restful_requests_total{method=\"GET\",route=\"/hello\"}") == 3);
+  CHECK(metric(s, "restful_client_errors_total{method=\"GET\",route=\"/hello\"}") == 0);
+  CHECK(metric(s, "restful_server_errors_total{method=\"GET\",route=\"/broken\"}") == 1);
+  CHECK(metric(s, "restful_client_errors_total{method=\"GET\",route=\"/denied\"}") == 1);
+  CHECK(metric(s, "restful_requests_total{method=\"POST\",route=\"/slow\"}") == 0);
+  CHECK(metric(s, "restful_not_found_total") == 1);
+}
+
+TEST(requests_without_handler_are_counted_by_status) {
+  static char buf[512];
+  static RESTHANDLER upgradable[] = {
+    {"GET", "/hello", hello},
+    {"GET", "/ws", hello, RESTFUL_WEBSOCKET}
+  };
+  RESTful rest(buf, sizeof(buf), 64, upgradable, 2);
+  MockState m;
+  std::string s;
+  
+  roundtrip(rest, m, "GET /missing HTTP/1.1\r\n\r\n");
+  roundtrip(rest, m, "POST /hello HTTP/1.1\r\n\r\n");
+  roundtrip(rest, m, "DELETE /hello HTTP/1.1\r\n\r\n");
+  roundtrip(rest, m, "BREW /hello HTTP/1.1\r\n\r\n");
+  roundtrip(rest, m, "OPTIONS /hello HTTP/1.1\r\n\r\n");
+  // Upgrade without key is refused on its route
+  roundtrip(rest, m, "GET /ws HTTP/1.1\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n\r\n");
+  
+  s = scrape(rest);
+  CHECK(metric(s, "restful_not_found_total") == 1);
+  CHECK(metric(s, "restful_method_not_allowed_total") == 2);
+  CHECK(metric(s, "restful_not_implemented_total") == 1);
+  CHECK(metric(s, "restful_requests_total{method=\"GET\",route=\"/ws\"}") == 1);
+  CHECK(metric(s, "restful_client_errors_total{method=\"GET\",route=\"/ws\"}") == 1);
+}
+
+TEST(bytes_in_and_out_are_counted) {
+  static char buf[512];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 4);
+  MockState m;
+  std::string req = "POST /slow HTTP/1.1\r\nContent-Length: 4\r\n\r\n";
+  std::string s;
+  
+  roundtrip(rest, m, req + "abcd");
+  s = scrape(rest);
+  CHECK(metric(s, "restful_received_bytes_total{method=\"POST\",route=\"/slow\"}") == (long)req.size() + 4);
+  CHECK(metric(s, "restful_sent_bytes_total{method=\"POST\",route=\"/slow\"}") == (long)m.out.size());
+}
+
+TEST(failures_are_counted_globally) {
+  static char buf[256];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 4);
+  MockState m;
+  MockClient client(&m);
+  std::string s;
+  
+  roundtrip(rest, m, "GARBAGE\r\n\r\n");
+  roundtrip(rest, m, "GET /hello HTTP/1.1\r\nX-Long: " + std::string(400, 'x') + "\r\n\r\n");
+  
+  rest.timeout(20);
+  m.reset();
+  m.push("GET /hello HTTP/1.1\r\n");
+  rest.loop(client);
+  
+  s = scrape(rest);
+  CHECK(metric(s, "restful_parse_failures_total") == 1);
+  CHECK(metric(s, "restful_overflows_total") == 1);
+  CHECK(metric(s, "restful_timeouts_total") == 1);
+}
+
+TEST(histograms_are_cumulative) {
+  static char buf[512];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 4);
+  MockState m;
+  std::string s;
+  
+  roundtrip(rest, m, "GET /hello HTTP/1.1\r\n\r\n");
+  roundtrip(rest, m, "POST /slow HTTP/1.1\r\n\r\n");
+  
+  s = scrape(rest);
+  // Scrape itself is dispatched before it is rendered, so it is counted too
+  CHECK(s.find("\n# TYPE restful_dispatch_milliseconds histogram\n") != std::string::npos);
+  CHECK(metric(s, "restful_dispatch_milliseconds_count") == 3);
+  CHECK(metric(s, "restful_dispatch_milliseconds_bucket{le=\"+Inf\"}") == 3);
+  CHECK(metric(s, "restful_dispatch_milliseconds_bucket{le=\"4\"}") == 2);
+  CHECK(metric(s, "restful_dispatch_milliseconds_bucket{le=\"1024\"}") == 3);
+  CHECK(metric(s, "restful_dispatch_milliseconds_sum") >= 6);
+  CHECK(metric(s, "restful_send_milliseconds_count") == 2);
+  CHECK(metric(s, "restful_receive_milliseconds_count") == 2);
+}
+
+TEST(metrics_fit_small_buffer_by_whole_lines) {
+  static char buf[128];
+  RESTful rest(buf, sizeof(buf), 32, handlers, 4);
+  MockState m;
+  std::string s;
+  size_t lines = 0;
+  
+  roundtrip(rest, m, "GET /hello HTTP/1.1\r\n\r\n");
+  s = scrape(rest);
+  for (size_t i = 1;i < s.size();i = s.find('\n', i) + 1) {
+    CHECK(s.find('\n', i) != std::string::npos);
+    lines++;
+  }
+  CHECK(lines == 6 + 4 * 5 + 3 * 15);
+  CHECK(metric(s, "restful_requests_total{method=\"GET\",route=\"/hello\"}") == 1);
+}
+
+TEST(memory_is_constant) {
+  static char buf[512];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 4);
+  MockState m;
+  MockClient client(&m);
+  long allocs;
+  
+  m.push("GET /metrics HTTP/1.1\r\n\r\n");
+  m.halfclosed = true;
+  m.out.reserve(64 * 1024);
+  rest.loop(client);
+  
+  allocs = g_allocs;
+  for (int i = 0;i < 10;++i) {
+    m.rewind();
+    rest.loop(client);
+  }
+  
+  CHECK(g_allocs - allocs == 0);
+  CHECK(sizeof(RESTMETRICS) == RESTFUL_METRICS_ROUTES * sizeof(RESTROUTEMETRICS) + 3 * sizeof(RESTHISTOGRAM) + 6 * sizeof(unsigned long));
+}
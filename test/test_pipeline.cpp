@@ -0,0 +1,60 @@
+#include "harness.h"
+
+/*
+ * Host shim and request pipeline
+ */
+static void sensor(Request* req, Response* res, RESTCLIENT* client) {
+  (void)client;
+  res->body(String("id=") + req->parameter(F("id")) + String(" unit=") + req->query(F("unit")));
+}
+
+static void led(Request* req, Response* res, RESTCLIENT* client) {
+  (void)client;
+  res->body(String("body=") + req->body());
+}
+
+static RESTHANDLER handlers[] = {
+  {"GET", "/api/sensors/:id", sensor},
+  {"POST", "/api/leds/:id", led},
+  {"PUT", "/api/config", led}
+};
+
+TEST(corpus_uses_crlf_in_header_only) {
+  std::string s = corpus("curl-post.http");
+  
+  CHECK(s.find("POST /api/leds/2 HTTP/1.1\r\nHost: 192.168.1.177\r\n") == 0);
+  CHECK(s.find("\r\n\r\n{\"state\":\"on\"") != std::string::npos);
+  CHECK(count(s, "\n") == count(s, "\r\n") + 1);
+}
+
+TEST(mock_releases_fragments_in_order) {
+  MockState m;
+  MockClient client(&m);
+  uint8_t b[8];
+  
+  m.push("abc");
+  m.push("de");
+  m.hold(1);
+  m.maxread = 2;
+  CHECK(client.available() == 3);
+  CHECK(client.read(b, 8) == 2 && !memcmp(b, "ab", 2));
+  CHECK(client.read(b, 8) == 1 && b[0] == 'c');
+  CHECK(client.read(b, 8) == -1);
+  m.release();
+  CHECK(client.available() == 2);
+  CHECK(client.read(b, 8) == 2 && !memcmp(b, "de", 2));
+  CHECK(m.reads == 4 && m.bytes_in == 5);
+}
+
+TEST(every_capture_is_answered) {
+  static char buf[1024];
+  RESTful rest(buf, sizeof(buf), 256, handlers, 3);
+  MockState m;
+  
+  CHECK(roundtrip(rest, m, corpus("chrome.http")).find("200 OK") != std::string::npos);
+  CHECK(m.out.find("\r\n\r\nid=3 unit=c") != std::string::npos);
+  CHECK(roundtrip(rest, m, corpus("firefox.http")).find("id=3 unit=c") != std::string::npos);
+  CHECK(roundtrip(rest, m, corpus("curl.http")).find("id=3 unit=c") != std::string::npos);
+  CHECK(roundtrip(rest, m, corpus("curl-post.http")).find("body={\"state\":\"on\",\"brightness\":128}") != std::string::npos);
+  CHECK(roundtrip(rest, m, corpus("chrome-put.http")).find("body=name=kitchen&interval=30000") != std::string::npos);
+}
@@ -0,0 +1,186 @@
+#include "harness.h"
+
+/*
+ * HTTP pipelining
+ */
+static void item(Request* req, Response* res, RESTCLIENT* client) {
+  (void)client;
+  res->body(String("item ") + req->parameter(F("id")) + String(";"));
+}
+
+static void store(Request* req, Response* res, RESTCLIENT* client) {
+  char buf[64];
+  int n = 0;
+  int r;
+  
+  (void)client;
+  while ((r = req->read(&buf[n], sizeof(buf) - 1 - n)) > 0)
+    n += r;
+  buf[n] = '\0';
+  res->body(String("stored ") + String(buf) + String(";"));
+}
+
+static RESTHANDLER handlers[] = {
+  {"GET", "/items/:id", item},
+  {"POST", "/items", store}
+};
+
+static std::string get(int id) {
+  return "GET /items/" + std::to_string(id) + " HTTP/1.1\r\nHost: x\r\n\r\n";
+}
+
+// Bodies of responses in order of output
+static std::string bodies(const std::string& s) {
+  std::string r;
+  
+  for (size_t i = s.find("\r\n\r\n");i != std::string::npos;i = s.find("\r\n\r\n", i + 4)) {
+    size_t end = s.find(';', i);
+    
+    if (end != std::string::npos && s.compare(i + 4, 4, "HTTP") != 0)
+      r += s.substr(i + 4, end + 1 - (i + 4));
+  }
+  
+  return r;
+}
+
+TEST(responses_follow_request_order) {
+  static char buf[1024];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 2);
+  MockState m;
+  std::string s;
+  
+  rest.keepalive_requests(100);
+  for (int i = 1;i <= 5;++i)
+    s += get(i);
+  roundtrip(rest, m, s);
+  CHECK(bodies(m.out) == "item 1;item 2;item 3;item 4;item 5;");
+  CHECK(m.reads <= 2);
+}
+
+TEST(bodies_are_kept_apart_from_next_request) {
+  static char buf[1024];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 2);
+  MockState m;
+  
+  rest.keepalive_requests(100);
+  roundtrip(rest, m, "POST /items HTTP/1.1\r\nContent-Length: 3\r\n\r\nabc" + get(1) +
+    "POST /items HTTP/1.1\r\nContent-Length: 2\r\n\r\nxy" + get(2));
+  CHECK(bodies(m.out) == "stored abc;item 1;stored xy;item 2;");
+}
+
+TEST(request_split_between_reads_is_joined) {
+  static char buf[1024];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 2);
+  MockState m;
+  MockClient client(&m);
+  std::string s = get(1) + get(2) + get(3);
+  
+  rest.keepalive_requests(100);
+  m.push(s.substr(0, 50));
+  m.push(s.substr(50, 37));
+  m.push(s.substr(87));
+  m.segmented = true;
+  m.halfclosed = true;
+  rest.loop(client);
+  CHECK(bodies(m.out) == "item 1;item 2;item 3;");
+}
+
+TEST(half_closed_peer_gets_every_answer) {
+  static char buf[1024];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 2);
+  MockState m;
+  MockClient client(&m);
+  
+  rest.keepalive_requests(100);
+  // Peer is gone as soon as input is read, buffered requests are still answered
+  m.push(get(1) + get(2) + get(3));
+  m.halfclosed = true;
+  CHECK(rest.loop(client) == RESTFUL_DISPATCHED);
+  CHECK(bodies(m.out) == "item 1;item 2;item 3;");
+}
+
+// Pipelined bytes are moved to buffer start, so response is not cut by room left behind them
+TEST(each_response_takes_one_write) {
+  static char buf[512];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 2);
+  MockState m;
+  std::string s;
+  
+  rest.keepalive_requests(100);
+  for (int i = 1;i <= 20;++i)
+    s += get(i);
+  roundtrip(rest, m, s);
+  CHECK(count(m.out, "HTTP/1.1 200 OK") == 20);
+  CHECK(m.writes == 20);
+}
+
+TEST(connection_close_ends_pipeline) {
+  static char buf[1024];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 2);
+  MockState m;
+  
+  rest.keepalive_requests(100);
+  roundtrip(rest, m, get(1) + "GET /items/2 HTTP/1.1\r\nConnection: close\r\n\r\n" + get(3));
+  CHECK(bodies(m.out) == "item 1;item 2;");
+}
+
+TEST(one_request_per_connection_in_each_pass) {
+  static char buf[1024];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 2);
+  RESTCONNECTION conn[2];
+  MockState a;
+  MockState b;
+  MockClient ca(&a);
+  MockClient cb(&b);
+  
+  rest.keepalive_requests(100);
+  rest.connections(conn, 2);
+  a.push(get(1) + get(2) + get(3));
+  b.push(get(9));
+  CHECK(rest.accept(ca));
+  CHECK(rest.accept(cb));
+  
+  rest.service();
+  CHECK(bodies(a.out) == "item 1;");
+  CHECK(bodies(b.out) == "item 9;");
+  rest.service();
+  rest.service();
+  CHECK(bodies(a.out) == "item 1;item 2;item 3;");
+}
+
+TEST(chunked_request_is_refused_and_closed) {
+  static char buf[1024];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 2);
+  MockState m;
+  
+  rest.keepalive_requests(100);
+  roundtrip(rest, m, "POST /items HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nabc\r\n0\r\n\r\n" + get(1));
+  CHECK(m.out.find("HTTP/1.1 411 ") == 0);
+  CHECK(m.out.find("item 1") == std::string::npos);
+}
+
+TEST(invalid_length_closes_connection) {
+  static char buf[1024];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 2);
+  MockState m;
+  
+  rest.keepalive_requests(100);
+  roundtrip(rest, m, "POST /items HTTP/1.1\r\nContent-Length: 3x\r\n\r\nabc" + get(1));
+  CHECK(m.out.find("HTTP/1.1 400 ") == 0);
+  CHECK(m.out.find("Connection: close\r\n") != std::string::npos);
+  CHECK(m.out.find("stored") == std::string::npos);
+  CHECK(m.out.find("item 1") == std::string::npos);
+}
+
+// Length wrapping to 1 would leave rest of body to be served as request of its own
+TEST(length_beyond_range_is_refused) {
+  static char buf[1024];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 2);
+  MockState m;
+  
+  rest.keepalive_requests(100);
+  roundtrip(rest, m, "POST /items HTTP/1.1\r\nContent-Length: 18446744073709551617\r\n\r\nx" + get(1));
+  CHECK(m.out.find("HTTP/1.1 400 ") == 0);
+  CHECK(count(m.out, "HTTP/1.1 ") == 1);
+  CHECK(m.out.find("item 1") == std::string::npos);
+}
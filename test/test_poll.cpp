@@ -0,0 +1,124 @@
+#include "harness.h"
+
+/*
+ * Non-blocking reception
+ * 
+ * poll consumes what is available and returns at once.
+ */
+static void ok(Request* req, Response* res, RESTCLIENT* client) {
+  (void)client;
+  res->body(req->url());
+}
+
+static RESTHANDLER handlers[] = {
+  {"GET", "/api/sensors/:id", ok}
+};
+
+TEST(one_byte_per_poll) {
+  static char buf[1024];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 1);
+  MockState m;
+  MockClient client(&m);
+  std::string s = corpus("curl.http");
+  unsigned long worst = 0;
+  
+  m.trickle(s);
+  m.hold(0);
+  for (size_t i = 0;i < s.size();++i) {
+    unsigned long ts;
+    int r;
+    
+    m.release();
+    ts = millis();
+    r = rest.poll(client);
+    worst = max(worst, millis() - ts);
+    CHECK(r == ((i + 1 < s.size()) ? (RESTFUL_NEED_MORE) : (RESTFUL_DISPATCHED)));
+  }
+  
+  CHECK(worst < 10);
+  CHECK(m.reads == (long)s.size());
+  CHECK(m.out.find("/api/sensors/3") != std::string::npos);
+}
+
+TEST(poll_without_bytes_returns_at_once) {
+  static char buf[512];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 1);
+  MockState m;
+  MockClient client(&m);
+  unsigned long ts = millis();
+  
+  for (int i = 0;i < 1000;++i)
+    CHECK(rest.poll(client) == RESTFUL_NEED_MORE);
+  CHECK(millis() - ts < 50);
+  CHECK(m.reads == 0);
+}
+
+TEST(trickling_client_times_out_from_first_byte) {
+  static char buf[1024];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 1);
+  MockState m;
+  MockClient client(&m);
+  std::string s = corpus("chrome.http");
+  unsigned long ts = millis();
+  int r = RESTFUL_NEED_MORE;
+  
+  rest.timeout(40);
+  m.trickle(s);
+  m.hold(0);
+  for (size_t i = 0;i < s.size() && r == RESTFUL_NEED_MORE;++i) {
+    m.release();
+    r = rest.poll(client);
+    usleep(2000);
+  }
+  
+  CHECK(r == RESTFUL_ERROR);
+  CHECK(m.out.find("408") != std::string::npos);
+  CHECK(millis() - ts < 100);
+  CHECK(m.stops == 1);
+}
+
+TEST(second_client_waits_for_request_in_progress) {
+  static char buf[1024];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 1);
+  MockState a;
+  MockState b;
+  MockClient ca(&a);
+  MockClient cb(&b);
+  
+  a.push("GET /api/sensors/1 HT");
+  a.push("TP/1.1\r\nHost: x\r\n\r\n");
+  a.hold(1);
+  b.push("GET /api/sensors/2 HTTP/1.1\r\nHost: x\r\n\r\n");
+  
+  CHECK(rest.poll(ca) == RESTFUL_NEED_MORE);
+  CHECK(rest.poll(cb) == RESTFUL_NEED_MORE);
+  CHECK(b.reads == 0);
+  
+  // Rest of first request is taken while second client is polled
+  a.release();
+  CHECK(rest.poll(cb) == RESTFUL_DISPATCHED);
+  CHECK(a.out.find("\r\n\r\n/api/sensors/1") != std::string::npos);
+  CHECK(b.out.find("\r\n\r\n/api/sensors/2") != std::string::npos);
+  CHECK(a.out.find("/api/sensors/2") == std::string::npos);
+}
+
+TEST(second_client_is_served_once_first_times_out) {
+  static char buf[1024];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 1);
+  MockState a;
+  MockState b;
+  MockClient ca(&a);
+  MockClient cb(&b);
+  
+  rest.timeout(20);
+  a.push("GET /api/sensors/1 HT");
+  b.push("GET /api/sensors/2 HTTP/1.1\r\nHost: x\r\n\r\n");
+  CHECK(rest.poll(ca) == RESTFUL_NEED_MORE);
+  CHECK(rest.poll(cb) == RESTFUL_NEED_MORE);
+  
+  usleep(30000);
+  CHECK(rest.poll(cb) == RESTFUL_DISPATCHED);
+  CHECK(a.out.find("408") != std::string::npos);
+  CHECK(a.stops == 1);
+  CHECK(b.out.find("\r\n\r\n/api/sensors/2") != std::string::npos);
+}
@@ -0,0 +1,107 @@
+#include "harness.h"
+
+/*
+ * Concurrent connections
+ * 
+ * Clients sending at different byte rates share one pool. Latency of each request is
+ * counted in service passes from its release to its response.
+ */
+static void ok(Request* req, Response* res, RESTCLIENT* client) {
+  (void)client;
+  res->body(req->url());
+}
+
+static RESTHANDLER handlers[] = {
+  {"GET", "/api/sensors/:id", ok}
+};
+
+struct Sim {
+  MockState m;
+  int rate;
+  int requests;
+  int sent;
+  int answered;
+  long released;
+  std::vector<long> latency;
+};
+
+TEST(slow_client_does_not_delay_others) {
+  static char buf[4096];
+  RESTCONNECTION conn[4];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 1);
+  std::string s = corpus("curl.http");
+  Sim sim[4];
+  std::vector<long> all;
+  long pass;
+  
+  rest.connections(conn, 4);
+  rest.keepalive_requests(100);
+  
+  // First client sends one byte per pass, others whole requests at different rates
+  for (int i = 0;i < 4;++i) {
+    MockClient client(&sim[i].m);
+    
+    sim[i].rate = (i == 0) ? (1) : (s.size() / i);
+    sim[i].requests = (i == 0) ? (1) : (20);
+    sim[i].sent = 0;
+    sim[i].answered = 0;
+    for (int k = 0;k < sim[i].requests;++k)
+      sim[i].m.push(s);
+    sim[i].m.maxread = sim[i].rate;
+    CHECK(rest.accept(client));
+  }
+  
+  for (pass = 0;pass < 10000;++pass) {
+    bool done = true;
+    
+    for (int i = 0;i < 4;++i) {
+      Sim* c = &sim[i];
+      
+      // Next request is released once previous one is answered
+      if (c->sent == c->answered && c->sent < c->requests) {
+        c->sent++;
+        c->released = pass;
+      }
+      c->m.hold(c->sent);
+      done = done && (c->answered == c->requests);
+    }
+    if (done)
+      break;
+    
+    rest.service();
+    for (int i = 0;i < 4;++i) {
+      Sim* c = &sim[i];
+      int n = count(c->m.out, "HTTP/1.1 200 OK");
+      
+      if (n > c->answered) {
+        c->answered = n;
+        c->latency.push_back(pass - c->released + 1);
+        if (i > 0)
+          all.push_back(pass - c->released + 1);
+      }
+    }
+  }
+  
+  std::sort(all.begin(), all.end());
+  printf("     fast clients p50 %ld p99 %ld max %ld passes, slow client %ld passes\n",
+    all[all.size() / 2], all[all.size() * 99 / 100], all.back(), sim[0].latency[0]);
+  CHECK(pass < 10000);
+  CHECK(sim[0].latency[0] >= (long)s.size());
+  CHECK(all.back() <= 3);
+}
+
+TEST(full_pool_refuses_client) {
+  static char buf[2048];
+  RESTCONNECTION conn[2];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 1);
+  MockState m[3];
+  MockClient a(&m[0]);
+  MockClient b(&m[1]);
+  MockClient c(&m[2]);
+  
+  rest.connections(conn, 2);
+  CHECK(rest.accept(a));
+  CHECK(rest.accept(b));
+  CHECK(rest.accept(a));
+  CHECK(!rest.accept(c));
+}
@@ -0,0 +1,187 @@
+#define RESTFUL_CLIENT                            PosixClient
+#include "harness.h"
+
+#include <arpa/inet.h>
+#include <signal.h>
+
+/*
+ * POSIX backend
+ * 
+ * Real loopback sockets served through epoll readiness of PosixServer.
+ */
+static long g_total;
+
+static int bulk(char* buf, int n, void* context) {
+  long* left = (long*)context;
+  int k = (int)std::min((long)n, *left);
+  
+  memset(buf, 'x', k);
+  *left -= k;
+  return k;
+}
+
+static void hello(Request* req, Response* res, RESTCLIENT* client) {
+  (void)client;
+  res->body(String("hello ") + String(req->url()));
+}
+
+static void huge(Request* req, Response* res, RESTCLIENT* client) {
+  (void)req;
+  (void)client;
+  g_total = 64L * 1024 * 1024;
+  res->stream(bulk, &g_total);
+}
+
+static RESTHANDLER handlers[] = {
+  {"GET", "/huge", huge},
+  {"GET", "/:name", hello}
+};
+
+static int dial(int port) {
+  struct sockaddr_in addr;
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  int sz = 4096;
+  
+  memset(&addr, 0x00, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &sz, sizeof(sz));
+  if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    perror("connect");
+    exit(2);
+  }
+  
+  return fd;
+}
+
+// Read until needle arrives, peer closes or 1 s passes
+static std::string expect(int fd, const char* needle) {
+  std::string s;
+  unsigned long ts = millis();
+  
+  while (s.find(needle) == std::string::npos && millis() - ts < 1000) {
+    struct pollfd p = { fd, POLLIN, 0 };
+    char buf[512];
+    int n;
+    
+    if (::poll(&p, 1, 10) <= 0)
+      continue;
+    if ((n = read(fd, buf, sizeof(buf))) <= 0)
+      break;
+    s.append(buf, n);
+  }
+  
+  return s;
+}
+
+struct Fixture {
+  char buf[4096];
+  RESTCONNECTION conn[4];
+  RESTful rest;
+  PosixServer server;
+  
+  Fixture(int port) : rest(buf, sizeof(buf), 64, handlers, 2), server(port) {
+    signal(SIGPIPE, SIG_IGN);
+    rest.connections(conn, 4);
+    rest.keepalive_requests(100);
+    if (!this->server.begin()) {
+      perror("begin");
+      exit(2);
+    }
+  }
+  
+  // Accept and watch one client, returns its slot
+  int admit() {
+    PosixClient client;
+    unsigned long ts = millis();
+    int slot;
+    
+    while (!this->server.accept(client) && millis() - ts < 1000)
+      this->server.wait(10);
+    slot = this->rest.attach(client);
+    this->server.watch(client, slot);
+    return slot;
+  }
+};
+
+TEST(only_ready_slot_is_reported) {
+  Fixture f(18090);
+  int a = dial(18090);
+  int sa = f.admit();
+  int b = dial(18090);
+  int sb = f.admit();
+  
+  CHECK(sa >= 0 && sb >= 0 && sa != sb);
+  CHECK(write(b, "GET /b HTTP/1.1\r\n\r\n", 19) == 19);
+  CHECK(f.server.wait(1000) == 1);
+  CHECK(f.server.ready() == 1);
+  CHECK(f.server.slot(0) == sb);
+  CHECK(f.rest.service(f.server.slot(0)) == RESTFUL_DISPATCHED);
+  CHECK(expect(b, "hello /b").find("HTTP/1.1 200 OK") == 0);
+  
+  // Idle connection gives no event
+  CHECK(f.server.wait(20) == 0);
+  close(a);
+  close(b);
+}
+
+TEST(sweep_serves_pipelined_request) {
+  Fixture f(18091);
+  int a = dial(18091);
+  int sa = f.admit();
+  const char* two = "GET /one HTTP/1.1\r\n\r\nGET /two HTTP/1.1\r\n\r\n";
+  std::string out;
+  
+  CHECK(write(a, two, strlen(two)) == (int)strlen(two));
+  CHECK(f.server.wait(1000) == 1);
+  CHECK(f.rest.service(f.server.slot(0)) == RESTFUL_DISPATCHED);
+  
+  // Second request is already read, so only sweep can find it
+  CHECK(f.server.wait(20) == 0);
+  f.rest.sweep();
+  out = expect(a, "hello /two");
+  CHECK(out.find("hello /one") < out.find("hello /two"));
+  CHECK(f.rest.service(sa) == RESTFUL_NEED_MORE);
+  close(a);
+}
+
+TEST(sweep_closes_idle_connection) {
+  Fixture f(18092);
+  int a = dial(18092);
+  int sa = f.admit();
+  
+  f.rest.keepalive_timeout(30);
+  CHECK(write(a, "GET /a HTTP/1.1\r\n\r\n", 19) == 19);
+  f.server.wait(1000);
+  CHECK(f.rest.service(sa) == RESTFUL_DISPATCHED);
+  expect(a, "hello /a");
+  
+  f.rest.sweep();
+  CHECK(f.conn[sa].used);
+  usleep(40000);
+  f.rest.sweep();
+  CHECK(!f.conn[sa].used);
+  CHECK(expect(a, "never").empty());
+  close(a);
+}
+
+TEST(slow_reader_is_cut_off) {
+  Fixture f(18093);
+  int a = dial(18093);
+  int sa = f.admit();
+  int sz = 4096;
+  unsigned long ts;
+  
+  setsockopt(f.conn[sa].client.fd(), SOL_SOCKET, SO_SNDBUF, &sz, sizeof(sz));
+  CHECK(write(a, "GET /huge HTTP/1.1\r\n\r\n", 22) == 22);
+  f.server.wait(1000);
+  
+  // Peer never reads, write gives up after its deadline instead of waiting per block
+  ts = millis();
+  f.rest.service(sa);
+  CHECK(millis() - ts < 4 * RESTFUL_POSIX_WRITE_TIMEOUT);
+  CHECK(g_total > 0);
+  CHECK(!f.conn[sa].used);
+  close(a);
+}
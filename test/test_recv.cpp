@@ -0,0 +1,67 @@
+#include "harness.h"
+
+/*
+ * Block-wise reception
+ * 
+ * Request is read by blocks, so read calls follow fragments of peer instead of bytes.
+ */
+static void ok(Request* req, Response* res, RESTCLIENT* client) {
+  (void)req;
+  (void)client;
+  res->body(F("ok"));
+}
+
+static RESTHANDLER handlers[] = {
+  {"GET", "/api/sensors/:id", ok}
+};
+
+TEST(whole_request_takes_one_read) {
+  static char buf[1024];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 1);
+  MockState m;
+  std::string s = corpus("firefox.http");
+  
+  CHECK(roundtrip(rest, m, s).find("200 OK") != std::string::npos);
+  CHECK(m.reads == 1);
+  CHECK(m.bytes_in == (long)s.size());
+}
+
+TEST(reads_follow_fragments) {
+  static char buf[1024];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 1);
+  MockState m;
+  MockClient client(&m);
+  std::string s = corpus("chrome.http");
+  
+  m.maxread = 64;
+  m.push(s);
+  m.halfclosed = true;
+  rest.loop(client);
+  CHECK(m.out.find("200 OK") != std::string::npos);
+  CHECK(m.reads == (long)(s.size() + 63) / 64);
+}
+
+TEST(blank_line_split_across_blocks) {
+  static char buf[512];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 1);
+  MockState m;
+  MockClient client(&m);
+  
+  m.push("GET /api/sensors/1 HTTP/1.1\r\nHost: x\r\n\r");
+  m.push("\n");
+  m.hold(1);
+  CHECK(rest.poll(client) == RESTFUL_NEED_MORE);
+  m.release();
+  CHECK(rest.poll(client) == RESTFUL_DISPATCHED);
+  CHECK(m.out.find("200 OK") != std::string::npos);
+  CHECK(m.reads == 2);
+}
+
+TEST(reception_stops_at_buffer_bound) {
+  static char buf[256];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 1);
+  MockState m;
+  
+  CHECK(roundtrip(rest, m, corpus("chrome.http")).find("431") != std::string::npos);
+  CHECK(m.bytes_in <= 256);
+}
@@ -0,0 +1,147 @@
+#include "harness.h"
+
+/*
+ * Early rejection
+ * 
+ * Peers stay connected, so every answer has to come without waiting for receive timeout.
+ */
+static int g_calls;
+
+static void upload(Request* req, Response* res, RESTCLIENT* client) {
+  char buf[32];
+  
+  (void)client;
+  g_calls++;
+  while (req->read(buf, sizeof(buf)) > 0);
+  res->body(F("stored"));
+}
+
+static RESTHANDLER handlers[] = {
+  {"POST", "/upload", upload},
+  {"GET", "/", upload}
+};
+
+// Serve s to connected peer, returns response and time taken in ms
+static std::string serve(RESTful& rest, MockState& m, const std::string& s, unsigned long* ms) {
+  MockClient client(&m);
+  unsigned long ts = millis();
+  
+  m.reset();
+  m.push(s);
+  rest.loop(client);
+  *ms = millis() - ts;
+  return m.out;
+}
+
+TEST(long_request_line_gets_414_at_once) {
+  static char buf[256];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 2);
+  MockState m;
+  unsigned long ms;
+  
+  rest.timeout(2000);
+  CHECK(serve(rest, m, "GET /" + std::string(300, 'a'), &ms).find("HTTP/1.1 414 ") == 0);
+  CHECK(ms < 100);
+}
+
+TEST(large_header_gets_431_at_once) {
+  static char buf[256];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 2);
+  MockState m;
+  unsigned long ms;
+  
+  rest.timeout(2000);
+  CHECK(serve(rest, m, "GET / HTTP/1.1\r\nCookie: " + std::string(300, 'c'), &ms).find("HTTP/1.1 431 ") == 0);
+  CHECK(ms < 100);
+}
+
+TEST(large_body_gets_413_before_upload) {
+  static char buf[256];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 2);
+  MockState m;
+  unsigned long ms;
+  
+  rest.timeout(2000);
+  rest.content_length_limit(1024);
+  g_calls = 0;
+  CHECK(serve(rest, m, "POST /upload HTTP/1.1\r\nContent-Length: 4096\r\nExpect: 100-continue\r\n\r\n", &ms).find("HTTP/1.1 413 ") == 0);
+  CHECK(m.out.find("100 Continue") == std::string::npos);
+  CHECK(g_calls == 0);
+  CHECK(ms < 100);
+  
+  CHECK(serve(rest, m, "POST /upload HTTP/1.1\r\nContent-Length: 1024\r\n\r\n" + std::string(1024, 'x'), &ms).find("HTTP/1.1 200 ") == 0);
+}
+
+TEST(stalled_request_gets_408_at_timeout) {
+  static char buf[256];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 2);
+  MockState m;
+  unsigned long ms;
+  
+  rest.timeout(50);
+  CHECK(serve(rest, m, "GET / HTTP/1.1\r\nHost: x\r\n", &ms).find("HTTP/1.1 408 ") == 0);
+  CHECK(ms >= 50);
+  CHECK(ms < 150);
+}
+
+TEST(continue_is_sent_only_to_handler) {
+  static char buf[256];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 2);
+  MockState m;
+  MockClient client(&m);
+  
+  g_calls = 0;
+  m.push("POST /upload HTTP/1.1\r\nContent-Length: 5\r\nExpect: 100-continue\r\n\r\n");
+  m.push("hello");
+  m.segmented = true;
+  m.halfclosed = true;
+  rest.loop(client);
+  CHECK(g_calls == 1);
+  CHECK(m.out.find("HTTP/1.1 100 Continue\r\n\r\nHTTP/1.1 200 OK\r\n") == 0);
+}
+
+TEST(continue_is_not_sent_for_missing_route) {
+  static char buf[256];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 2);
+  MockState m;
+  MockClient client(&m);
+  
+  rest.keepalive_requests(10);
+  m.push("POST /nothing HTTP/1.1\r\nContent-Length: 5\r\nExpect: 100-continue\r\n\r\n");
+  CHECK(rest.poll(client) == RESTFUL_DISPATCHED);
+  CHECK(m.out.find("HTTP/1.1 404 ") == 0);
+  CHECK(m.out.find("100 Continue") == std::string::npos);
+  
+  // Body never comes, so connection is not kept for it
+  CHECK(m.out.find("Connection: close\r\n") != std::string::npos);
+  CHECK(m.stops == 1);
+}
+
+TEST(bad_clients_do_not_hold_pool) {
+  static char buf[1024];
+  static RESTCONNECTION conn[4];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 2);
+  MockState bad[3];
+  MockState good;
+  MockClient bc[3] = { MockClient(&bad[0]), MockClient(&bad[1]), MockClient(&bad[2]) };
+  MockClient gc(&good);
+  unsigned long ts = millis();
+  
+  rest.timeout(2000);
+  rest.connections(conn, 4);
+  bad[0].push("GET /" + std::string(300, 'a'));
+  bad[1].push("GET / HTTP/1.1\r\nCookie: " + std::string(300, 'c'));
+  bad[2].push("POST /upload HTTP/1.1\r\nContent-Length: 99999\r\n\r\n");
+  rest.content_length_limit(1024);
+  good.push("GET / HTTP/1.1\r\n\r\n");
+  for (int i = 0;i < 3;++i)
+    CHECK(rest.accept(bc[i]));
+  CHECK(rest.accept(gc));
+  
+  rest.service();
+  CHECK(bad[0].out.find("HTTP/1.1 414 ") == 0);
+  CHECK(bad[1].out.find("HTTP/1.1 431 ") == 0);
+  CHECK(bad[2].out.find("HTTP/1.1 413 ") == 0);
+  CHECK(good.out.find("HTTP/1.1 200 ") == 0);
+  CHECK(millis() - ts < 100);
+}
@@ -0,0 +1,207 @@
+#include "harness.h"
+
+/*
+ * Route table in flash
+ * 
+ * RESTROUTE table has to dispatch as handler array does.
+ */
+static std::string g_id;
+
+static void user(Request* req, Response* res, RESTCLIENT* client) {
+  (void)client;
+  g_id = req->parameter(F("id")).c_str();
+  res->body(F("user"));
+}
+
+static void update(Request* req, Response* res, RESTCLIENT* client) {
+  (void)req;
+  (void)client;
+  res->body(F("updated"));
+}
+
+static void me(Request* req, Response* res, RESTCLIENT* client) {
+  (void)req;
+  (void)client;
+  res->body(F("me"));
+}
+
+static const char users_me[] PROGMEM = "/users/me";
+static const char users_id[] PROGMEM = "/users/:id";
+
+static const RESTROUTE routes[] PROGMEM = {
+  { REST_GET, users_me, me },
+  { REST_GET, users_id, user },
+  { REST_PUT, users_id, update }
+};
+
+static RESTHANDLER handlers[] = {
+  {"GET", "/users/me", me},
+  {"GET", "/users/:id", user},
+  {"PUT", "/users/:id", update}
+};
+
+// Methods outside RESTMETHOD and HEAD are matched by their own handlers
+static RESTHANDLER others[] = {
+  {"GET", "/info", me},
+  {"PURGE", "/info", update},
+  {"HEAD", "/probe", me}
+};
+
+TEST(route_dispatches_with_parameters) {
+  static char buf[512];
+  RESTful rest(buf, sizeof(buf), 64, routes, 3);
+  MockState m;
+  
+  CHECK(roundtrip(rest, m, "GET /users/42 HTTP/1.1\r\n\r\n").find("\r\n\r\nuser") != std::string::npos);
+  CHECK(g_id == "42");
+  CHECK(roundtrip(rest, m, "GET /users/me HTTP/1.1\r\n\r\n").find("\r\n\r\nme") != std::string::npos);
+  CHECK(roundtrip(rest, m, "PUT /users/7 HTTP/1.1\r\n\r\n").find("\r\n\r\nupdated") != std::string::npos);
+}
+
+TEST(route_answers_head_and_other_methods) {
+  static char buf[512];
+  RESTful rest(buf, sizeof(buf), 64, routes, 3);
+  MockState m;
+  std::string out;
+  
+  out = roundtrip(rest, m, "HEAD /users/42 HTTP/1.1\r\n\r\n");
+  CHECK(out.find("200 OK") != std::string::npos);
+  CHECK(out.find("\r\n\r\n") + 4 == out.size());
+  
+  out = roundtrip(rest, m, "DELETE /users/42 HTTP/1.1\r\n\r\n");
+  CHECK(out.find("405 Method Not Allowed") != std::string::npos);
+  CHECK(out.find("Allow: GET, HEAD, PUT, OPTIONS\r\n") != std::string::npos);
+  CHECK(roundtrip(rest, m, "GET /groups/1 HTTP/1.1\r\n\r\n").find("404 Not Found") != std::string::npos);
+}
+
+TEST(unregistered_method_gets_501) {
+  static char buf[512];
+  RESTful rest(buf, sizeof(buf), 64, others, 3);
+  MockState m;
+  
+  CHECK(roundtrip(rest, m, "BREW /info HTTP/1.1\r\n\r\n").find("HTTP/1.1 501 Not Implemented\r\n") == 0);
+  CHECK(roundtrip(rest, m, "PURGE /info HTTP/1.1\r\n\r\n").find("\r\n\r\nupdated") != std::string::npos);
+  CHECK(roundtrip(rest, m, "PURGE /users/1 HTTP/1.1\r\n\r\n").find("HTTP/1.1 404 Not Found\r\n") == 0);
+}
+
+TEST(options_lists_every_method_of_path) {
+  static char buf[512];
+  RESTful rest(buf, sizeof(buf), 64, others, 3);
+  MockState m;
+  std::string out;
+  
+  out = roundtrip(rest, m, "OPTIONS /info HTTP/1.1\r\n\r\n");
+  CHECK(out.find("HTTP/1.1 204 No Content\r\n") == 0);
+  CHECK(out.find("Allow: GET, HEAD, OPTIONS, PURGE\r\n") != std::string::npos);
+  CHECK(out.find("Content-Length") == std::string::npos);
+  CHECK(out.find("\r\n\r\n") + 4 == out.size());
+  
+  out = roundtrip(rest, m, "DELETE /info HTTP/1.1\r\n\r\n");
+  CHECK(out.find("HTTP/1.1 405 Method Not Allowed\r\n") == 0);
+  CHECK(out.find("Allow: GET, HEAD, OPTIONS, PURGE\r\n") != std::string::npos);
+  CHECK(roundtrip(rest, m, "OPTIONS /none HTTP/1.1\r\n\r\n").find("HTTP/1.1 404 Not Found\r\n") == 0);
+}
+
+TEST(head_handler_is_matched_before_get) {
+  static char buf[512];
+  RESTful rest(buf, sizeof(buf), 64, others, 3);
+  MockState m;
+  std::string out;
+  
+  out = roundtrip(rest, m, "HEAD /probe HTTP/1.1\r\n\r\n");
+  CHECK(out.find("HTTP/1.1 200 OK\r\n") == 0);
+  CHECK(out.find("Content-Length: 2\r\n") != std::string::npos);
+  CHECK(out.find("\r\n\r\n") + 4 == out.size());
+  
+  out = roundtrip(rest, m, "GET /probe HTTP/1.1\r\n\r\n");
+  CHECK(out.find("HTTP/1.1 405 Method Not Allowed\r\n") == 0);
+  CHECK(out.find("Allow: HEAD, OPTIONS\r\n") != std::string::npos);
+}
+
+TEST(route_table_matches_handler_array) {
+  const char* urls[] = { "/users/me", "/users/1", "/users/", "/users/me/x", "/", "/users" };
+  
+  for (size_t i = 0;i < sizeof(urls) / sizeof(urls[0]);++i) {
+    char s[64];
+    Header ihdr;
+    Header ohdr;
+    Request req(&ihdr);
+    Response res(&ohdr);
+    RESTROUTE route;
+    RESTHANDLER* h;
+    int r;
+    
+    strcpy(s, urls[i]);
+    req._url = s;
+    req._failed = false;
+    h = RESTful::findhdlr(handlers, 3, "GET", &req, &res);
+    r = RESTful::findroute(routes, 3, REST_GET, &req, &res, &route);
+    CHECK(r == ((h != NULL) ? (int)(h - handlers) : (-1)));
+    if (r >= 0)
+      CHECK(route.request_callback == handlers[r].request_callback);
+  }
+}
+
+TEST(route_index_matches_table) {
+  const char* urls[] = { "/users/me", "/users/1", "/users/", "/users/me/x", "/", "/users", "/groups/1" };
+  static RESTNODE idx[16];
+  
+  CHECK(RESTful::buildidx_P(idx, 16, routes, 3));
+  for (size_t i = 0;i < sizeof(urls) / sizeof(urls[0]);++i) {
+    for (int k = 0;k < 2;++k) {
+      RESTMETHOD method = (k) ? (REST_PUT) : (REST_GET);
+      char s[64];
+      Header ihdr;
+      Header ohdr;
+      Request req(&ihdr);
+      Response res(&ohdr);
+      RESTROUTE a;
+      RESTROUTE b;
+      int r;
+      
+      strcpy(s, urls[i]);
+      req._url = s;
+      req._failed = false;
+      r = RESTful::findroute(routes, 3, method, &req, &res, &a);
+      CHECK(RESTful::findidx_P(idx, routes, method, &req, &res, &b) == r);
+      if (r >= 0)
+        CHECK(a.request_callback == b.request_callback);
+    }
+  }
+}
+
+TEST(indexed_route_table_dispatches) {
+  static char buf[512];
+  static RESTNODE idx[16];
+  RESTful rest(buf, sizeof(buf), 64, routes, 3, idx, 16);
+  MockState m;
+  
+  CHECK(rest._idx == idx);
+  CHECK(roundtrip(rest, m, "GET /users/42 HTTP/1.1\r\n\r\n").find("\r\n\r\nuser") != std::string::npos);
+  CHECK(g_id == "42");
+  CHECK(roundtrip(rest, m, "GET /users/me HTTP/1.1\r\n\r\n").find("\r\n\r\nme") != std::string::npos);
+  CHECK(roundtrip(rest, m, "PUT /users/7 HTTP/1.1\r\n\r\n").find("\r\n\r\nupdated") != std::string::npos);
+  CHECK(roundtrip(rest, m, "DELETE /users/7 HTTP/1.1\r\n\r\n").find("405 Method Not Allowed") != std::string::npos);
+}
+
+TEST(small_route_index_falls_back_to_scan) {
+  static char buf[512];
+  static RESTNODE idx[3];
+  RESTful rest(buf, sizeof(buf), 64, routes, 3, idx, 3);
+  MockState m;
+  
+  CHECK(rest._idx == NULL);
+  CHECK(roundtrip(rest, m, "GET /users/42 HTTP/1.1\r\n\r\n").find("\r\n\r\nuser") != std::string::npos);
+}
+
+// Table without flags is constant initialized, so it can stay in flash
+static constexpr RESTROUTE bare = { REST_GET, "/bare", me };
+static_assert(bare.flags == 0, "flags default to zero");
+
+TEST(flags_default_to_zero) {
+  RESTHANDLER h = { "GET", "/bare", me };
+  
+  CHECK(h.flags == 0);
+  CHECK(bare.request_callback == me);
+  CHECK(handlers[0].flags == 0);
+}
@@ -0,0 +1,171 @@
+#include "harness.h"
+
+/*
+ * Streaming response
+ */
+struct History {
+  long total;
+  long sent;
+  int calls;
+};
+
+// Produces total bytes of digits, as much as fits in each block
+static int history(char* buf, int n, void* context) {
+  History* h = (History*)context;
+  int k = (int)std::min((long)n, h->total - h->sent);
+  
+  for (int i = 0;i < k;++i)
+    buf[i] = '0' + (h->sent + i) % 10;
+  h->sent += k;
+  h->calls++;
+  return k;
+}
+
+static History g_history;
+
+static void sensor(Request* req, Response* res, RESTCLIENT* client) {
+  (void)req;
+  (void)client;
+  g_history.sent = 0;
+  g_history.calls = 0;
+  res->header()->set(F("Content-Type"), F("text/plain"));
+  res->stream(history, &g_history);
+}
+
+static RESTHANDLER handlers[] = {
+  {"GET", "/history", sensor},
+  {"HEAD", "/history", sensor}
+};
+
+static std::string digits(long n) {
+  std::string s;
+  
+  for (long i = 0;i < n;++i)
+    s += (char)('0' + i % 10);
+  return s;
+}
+
+// Decode chunked body, returns false if framing is broken
+static bool unchunk(const std::string& s, std::string* body, int* chunks) {
+  size_t i = 0;
+  
+  *chunks = 0;
+  while (true) {
+    size_t eol = s.find("\r\n", i);
+    long n;
+    
+    if (eol == std::string::npos)
+      return false;
+    n = strtol(s.substr(i, eol - i).c_str(), NULL, 16);
+    i = eol + 2;
+    if (n == 0)
+      return (s.substr(i) == "\r\n");
+    if (i + n + 2 > s.size() || s.compare(i + n, 2, "\r\n") != 0)
+      return false;
+    body->append(s, i, n);
+    i += n + 2;
+    (*chunks)++;
+  }
+}
+
+static std::string body(const std::string& s) {
+  size_t eoh = s.find("\r\n\r\n");
+  return (eoh == std::string::npos) ? ("") : (s.substr(eoh + 4));
+}
+
+TEST(stream_is_sent_chunked_over_http11) {
+  static char buf[256];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 2);
+  MockState m;
+  std::string data;
+  std::string out;
+  int chunks;
+  
+  g_history.total = 5000;
+  out = roundtrip(rest, m, "GET /history HTTP/1.1\r\n\r\n");
+  CHECK(out.find("Transfer-Encoding: chunked\r\n") != std::string::npos);
+  CHECK(out.find("Content-Length") == std::string::npos);
+  CHECK(unchunk(body(out), &data, &chunks));
+  CHECK(data == digits(5000));
+  CHECK(chunks > 1);
+  CHECK(g_history.calls == chunks + 1);
+}
+
+TEST(stream_is_sent_raw_over_http10_and_closed) {
+  static char buf[256];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 2);
+  MockState m;
+  MockClient client(&m);
+  
+  g_history.total = 3000;
+  rest.keepalive_requests(10);
+  m.push("GET /history HTTP/1.0\r\nConnection: keep-alive\r\n\r\n");
+  CHECK(rest.poll(client) == RESTFUL_DISPATCHED);
+  CHECK(m.out.find("Transfer-Encoding") == std::string::npos);
+  CHECK(m.out.find("Connection: close\r\n") != std::string::npos);
+  CHECK(body(m.out) == digits(3000));
+  CHECK(m.stops == 1);
+}
+
+TEST(empty_stream_ends_with_last_chunk) {
+  static char buf[256];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 2);
+  MockState m;
+  std::string data;
+  int chunks;
+  
+  g_history.total = 0;
+  CHECK(unchunk(body(roundtrip(rest, m, "GET /history HTTP/1.1\r\n\r\n")), &data, &chunks));
+  CHECK(chunks == 0);
+}
+
+TEST(head_does_not_call_producer) {
+  static char buf[256];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 2);
+  MockState m;
+  std::string out;
+  
+  g_history.total = 1000;
+  out = roundtrip(rest, m, "HEAD /history HTTP/1.1\r\n\r\n");
+  CHECK(out.find("200 OK") != std::string::npos);
+  CHECK(body(out).empty());
+  CHECK(g_history.calls == 0);
+}
+
+TEST(stream_keeps_connection_for_next_request) {
+  static char buf[256];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 2);
+  MockState m;
+  std::string out;
+  
+  g_history.total = 700;
+  rest.keepalive_requests(10);
+  out = roundtrip(rest, m, "GET /history HTTP/1.1\r\n\r\nGET /history HTTP/1.1\r\n\r\n");
+  CHECK(count(out, "HTTP/1.1 200 OK") == 2);
+  CHECK(count(out, "\r\n0\r\n\r\n") == 2);
+}
+
+// Heap held by serving one request, output of mock already has room for response
+static long peak(RESTful& rest, MockState& m, long total) {
+  MockClient client(&m);
+  
+  g_history.total = total;
+  m.reset();
+  m.push("GET /history HTTP/1.1\r\n\r\n");
+  m.halfclosed = true;
+  g_heappeak = g_heap;
+  rest.loop(client);
+  return g_heappeak - g_heap;
+}
+
+TEST(block_is_one_write_and_heap_is_flat) {
+  static char buf[256];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 2);
+  MockState m;
+  
+  m.out.reserve(128 * 1024);
+  CHECK(peak(rest, m, 64 * 1024) <= peak(rest, m, 1000));
+  
+  peak(rest, m, 64 * 1024);
+  CHECK(m.writes <= g_history.calls + 2);
+}
@@ -0,0 +1,73 @@
+#include "harness.h"
+
+/*
+ * Coalesced transmission
+ * 
+ * Status line, header fields and body share one buffer, which is written only when full or at the end.
+ */
+static const char page[] PROGMEM =
+  "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+  "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+  "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+  "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+  "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+  "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+  "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+  "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef";
+
+static void small(Request* req, Response* res, RESTCLIENT* client) {
+  (void)req;
+  (void)client;
+  res->header()->set(F("Content-Type"), F("application/json"));
+  res->body(F("{\"ok\":true}"));
+}
+
+static void large(Request* req, Response* res, RESTCLIENT* client) {
+  (void)req;
+  (void)client;
+  res->body((const __FlashStringHelper*)page);
+}
+
+static RESTHANDLER handlers[] = {
+  {"GET", "/small", small},
+  {"GET", "/large", large}
+};
+
+TEST(small_response_is_one_write) {
+  static char buf[512];
+  RESTful rest(buf, sizeof(buf), 128, handlers, 2);
+  MockState m;
+  
+  roundtrip(rest, m, "GET /small HTTP/1.1\r\n\r\n");
+  CHECK(m.writes == 1);
+  CHECK(m.out.find("HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n") == 0);
+  CHECK(m.out.find("Content-Length: 11\r\n") != std::string::npos);
+  CHECK(m.out.substr(m.out.size() - 15) == "\r\n\r\n{\"ok\":true}");
+}
+
+TEST(flash_body_is_written_by_full_blocks) {
+  static char buf[256];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 2);
+  MockState m;
+  long blocks;
+  
+  roundtrip(rest, m, "GET /large HTTP/1.1\r\n\r\n");
+  blocks = (m.bytes_out + rest._conn.bufsz - 1) / rest._conn.bufsz;
+  CHECK(m.out.find(page) != std::string::npos);
+  CHECK(m.bytes_out > (long)strlen(page));
+  CHECK(m.writes == blocks);
+}
+
+// Digits of 64-bit unsigned long fill 20 characters
+TEST(largest_number_is_printed_whole) {
+  char buf[64];
+  MockState m;
+  MockClient client(&m);
+  Transmitter tx(&client, buf, sizeof(buf));
+  
+  tx.print(0UL);
+  tx.print(F(" "));
+  tx.print(ULONG_MAX);
+  tx.flush();
+  CHECK(m.out == "0 " + std::to_string(ULONG_MAX));
+}
@@ -0,0 +1,202 @@
+#include "harness.h"
+
+/*
+ * WebSocket
+ */
+static WebSocket g_ws;
+
+static void telemetry(Request* req, Response* res, RESTCLIENT* client) {
+  (void)req;
+  g_ws.attach(client);
+  res->status(HTTP_101_SWITCHING_PROTOCOLS);
+}
+
+static void plain(Request* req, Response* res, RESTCLIENT* client) {
+  (void)req;
+  (void)client;
+  res->body(F("plain"));
+}
+
+static RESTHANDLER handlers[] = {
+  {"GET", "/ws", telemetry, RESTFUL_WEBSOCKET},
+  {"GET", "/plain", plain, 0}
+};
+
+static std::string upgrade(const char* key, const char* version) {
+  return std::string("GET /ws HTTP/1.1\r\nHost: x\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n") +
+    "Sec-WebSocket-Key: " + key + "\r\nSec-WebSocket-Version: " + version + "\r\n\r\n";
+}
+
+// Client frame is always masked
+static std::string frame(unsigned char opcode, const std::string& payload) {
+  const unsigned char mask[4] = { 0x37, 0xfa, 0x21, 0x3d };
+  std::string s;
+  
+  s += (char)(0x80 | opcode);
+  if (payload.size() < 126) {
+    s += (char)(0x80 | payload.size());
+  } else {
+    s += (char)(0x80 | 126);
+    s += (char)(payload.size() >> 8);
+    s += (char)(payload.size() & 0xFF);
+  }
+  s.append((const char*)mask, 4);
+  for (size_t i = 0;i < payload.size();++i)
+    s += (char)(payload[i] ^ mask[i & 3]);
+  return s;
+}
+
+// Upgrade connection of m and clear its output for frames
+static int upgraded(RESTful& rest, MockState& m, MockClient& client) {
+  int r;
+  
+  m.push(upgrade("dGhlIHNhbXBsZSBub25jZQ==", "13"));
+  r = rest.loop(client);
+  m.out.clear();
+  return r;
+}
+
+TEST(handshake_uses_rfc_sample_accept) {
+  static char buf[512];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 2);
+  MockState m;
+  MockClient client(&m);
+  
+  m.push(upgrade("dGhlIHNhbXBsZSBub25jZQ==", "13"));
+  CHECK(rest.loop(client) == RESTFUL_UPGRADED);
+  CHECK(m.out.find("HTTP/1.1 101 Switching Protocols\r\n") == 0);
+  CHECK(m.out.find("Upgrade: websocket\r\nConnection: Upgrade\r\n") != std::string::npos);
+  CHECK(m.out.find("Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n") != std::string::npos);
+  CHECK(m.stops == 0);
+  CHECK(g_ws.connected());
+}
+
+TEST(masked_frames_round_trip) {
+  static char buf[512];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 2);
+  MockState m;
+  MockClient client(&m);
+  std::string text = "{\"temp\":21.5}";
+  std::string big(300, 'b');
+  std::string got;
+  unsigned char opcode = 0;
+  char s[64];
+  int n;
+  
+  CHECK(upgraded(rest, m, client) == RESTFUL_UPGRADED);
+  CHECK(g_ws.receive(s, sizeof(s)) == 0);
+  
+  m.push(frame(RESTFUL_WS_TEXT, text));
+  n = g_ws.receive(s, sizeof(s), &opcode);
+  CHECK(n == (int)text.size());
+  CHECK(std::string(s, n) == text);
+  CHECK(opcode == RESTFUL_WS_TEXT);
+  
+  // Payload of extended length is read in parts
+  m.push(frame(RESTFUL_WS_BINARY, big));
+  while ((n = g_ws.receive(s, sizeof(s), &opcode)) > 0)
+    got.append(s, n);
+  CHECK(got == big);
+  CHECK(opcode == RESTFUL_WS_BINARY);
+  
+  CHECK(g_ws.send_text("hi"));
+  CHECK(m.out == std::string("\x81\x02hi", 4));
+  m.out.clear();
+  CHECK(g_ws.send(big.data(), big.size(), RESTFUL_WS_BINARY));
+  CHECK(m.out.substr(0, 4) == std::string("\x82\x7e\x01\x2c", 4));
+  CHECK(m.out.substr(4) == big);
+}
+
+TEST(length_form_follows_payload_size) {
+  static char buf[512];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 2);
+  MockState m;
+  MockClient client(&m);
+  std::string s(70000, 'x');
+  
+  CHECK(upgraded(rest, m, client) == RESTFUL_UPGRADED);
+  m.out.reserve(80000);
+  
+  CHECK(g_ws.send(s.data(), 125, RESTFUL_WS_BINARY));
+  CHECK(m.out.substr(0, 2) == std::string("\x82\x7d", 2));
+  CHECK(m.out.size() == 2 + 125);
+  m.out.clear();
+  
+  CHECK(g_ws.send(s.data(), 65535, RESTFUL_WS_BINARY));
+  CHECK(m.out.substr(0, 4) == std::string("\x82\x7e\xff\xff", 4));
+  CHECK(m.out.size() == 4 + 65535);
+  m.out.clear();
+  
+  CHECK(g_ws.send(s.data(), 65536, RESTFUL_WS_BINARY));
+  CHECK(m.out.substr(0, 10) == std::string("\x82\x7f\x00\x00\x00\x00\x00\x01\x00\x00", 10));
+  CHECK(m.out.size() == 10 + 65536);
+  m.out.clear();
+  
+  CHECK(g_ws.send(s.data(), s.size(), RESTFUL_WS_BINARY));
+  CHECK(m.out.substr(0, 10) == std::string("\x82\x7f\x00\x00\x00\x00\x00\x01\x11\x70", 10));
+  CHECK(m.out.substr(10) == s);
+}
+
+TEST(ping_gets_pong_and_close_is_echoed) {
+  static char buf[512];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 2);
+  MockState m;
+  MockClient client(&m);
+  char s[64];
+  
+  CHECK(upgraded(rest, m, client) == RESTFUL_UPGRADED);
+  m.push(frame(RESTFUL_WS_PING, "beat"));
+  CHECK(g_ws.receive(s, sizeof(s)) == 0);
+  CHECK(m.out == std::string("\x8a\x04" "beat", 6));
+  
+  m.out.clear();
+  m.push(frame(RESTFUL_WS_CLOSE, std::string("\x03\xe8", 2)));
+  CHECK(g_ws.receive(s, sizeof(s)) == -1);
+  CHECK(m.out == std::string("\x88\x02\x03\xe8", 4));
+  CHECK(m.stops == 1);
+  CHECK(!g_ws.connected());
+}
+
+TEST(unmasked_client_frame_fails_connection) {
+  static char buf[512];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 2);
+  MockState m;
+  MockClient client(&m);
+  char s[64];
+  
+  CHECK(upgraded(rest, m, client) == RESTFUL_UPGRADED);
+  m.push(std::string("\x81\x02hi", 4));
+  CHECK(g_ws.receive(s, sizeof(s)) == -1);
+  CHECK(m.out == std::string("\x88\x02\x03\xea", 4));
+}
+
+TEST(bad_handshake_is_refused) {
+  static char buf[512];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 2);
+  MockState m;
+  MockClient client(&m);
+  std::string out;
+  
+  // Key must be 16 bytes in base64
+  m.push(upgrade("c2hvcnQ=", "13"));
+  CHECK(rest.loop(client) == RESTFUL_DISPATCHED);
+  CHECK(m.out.find("HTTP/1.1 400 ") == 0);
+  
+  out = roundtrip(rest, m, upgrade(std::string(28, 'A').c_str(), "13"));
+  CHECK(out.find("HTTP/1.1 400 ") == 0);
+  
+  out = roundtrip(rest, m, upgrade("dGhlIHNhbXBsZSBub25jZQ==", "8"));
+  CHECK(out.find("HTTP/1.1 426 ") == 0);
+  CHECK(out.find("Sec-WebSocket-Version: 13\r\n") != std::string::npos);
+}
+
+TEST(upgrade_is_ignored_on_plain_route) {
+  static char buf[512];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 2);
+  MockState m;
+  std::string s = upgrade("dGhlIHNhbXBsZSBub25jZQ==", "13");
+  
+  s.replace(4, 3, "/plain");
+  CHECK(roundtrip(rest, m, s).find("HTTP/1.1 200 OK") == 0);
+  CHECK(m.out.find("Sec-WebSocket-Accept") == std::string::npos);
+}
@@ -0,0 +1,128 @@
+#include "harness.h"
+
+/*
+ * Response writer
+ */
+static int g_items;
+
+static void items(Request* req, Response* res, RESTCLIENT* client) {
+  Writer* w = res->writer();
+  
+  (void)req;
+  (void)client;
+  w->print(F("{\"items\":["));
+  for (int i = 0;i < g_items;++i) {
+    if (i > 0)
+      w->print(',');
+    w->print(F("{\"id\":"));
+    w->print(i);
+    w->print(F(",\"value\":"));
+    w->print(i * 0.5, 1);
+    w->print('}');
+  }
+  w->print(F("]}"));
+}
+
+static void escaped(Request* req, Response* res, RESTCLIENT* client) {
+  Writer* w = res->writer();
+  
+  (void)client;
+  w->print('"');
+  w->print_escaped(req->header()->get_view(F("X-Name")));
+  w->print_escaped("\t\x01");
+  w->print('"');
+}
+
+static void legacy(Request* req, Response* res, RESTCLIENT* client) {
+  (void)req;
+  (void)client;
+  res->body(String("plain ") + String(7L));
+}
+
+static RESTHANDLER handlers[] = {
+  {"GET", "/items", items},
+  {"GET", "/escaped", escaped},
+  {"GET", "/legacy", legacy}
+};
+
+static std::string body(const std::string& s) {
+  size_t eoh = s.find("\r\n\r\n");
+  return (eoh == std::string::npos) ? ("") : (s.substr(eoh + 4));
+}
+
+TEST(writer_builds_body_in_buffer) {
+  static char buf[1024];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 3);
+  MockState m;
+  std::string out;
+  
+  rest.writer_buffer_size(256);
+  g_items = 3;
+  out = roundtrip(rest, m, "GET /items HTTP/1.1\r\n\r\n");
+  CHECK(body(out) == "{\"items\":[{\"id\":0,\"value\":0.0},{\"id\":1,\"value\":0.5},{\"id\":2,\"value\":1.0}]}");
+  CHECK(out.find("Content-Length: " + std::to_string(body(out).size()) + "\r\n") != std::string::npos);
+}
+
+TEST(writer_makes_no_allocation) {
+  static char buf[1024];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 3);
+  MockState m;
+  MockClient client(&m);
+  long allocs;
+  
+  rest.writer_buffer_size(512);
+  g_items = 10;
+  m.push("GET /items HTTP/1.1\r\n\r\n");
+  m.halfclosed = true;
+  m.out.reserve(4096);
+  rest.loop(client);
+  
+  allocs = g_allocs;
+  m.rewind();
+  rest.loop(client);
+  CHECK(g_allocs == allocs);
+  CHECK(body(m.out).size() > 200);
+}
+
+TEST(overflow_fails_with_500_and_empty_body) {
+  static char buf[1024];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 3);
+  MockState m;
+  std::string out;
+  
+  rest.writer_buffer_size(64);
+  g_items = 10;
+  out = roundtrip(rest, m, "GET /items HTTP/1.1\r\n\r\n");
+  CHECK(out.find("HTTP/1.1 500 Internal Server Error\r\n") == 0);
+  CHECK(body(out).empty());
+}
+
+TEST(strings_are_escaped_for_json) {
+  static char buf[1024];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 3);
+  MockState m;
+  
+  rest.writer_buffer_size(128);
+  CHECK(body(roundtrip(rest, m, "GET /escaped HTTP/1.1\r\nX-Name: a\"b\\c\r\n\r\n")) == "\"a\\\"b\\\\c\\t\\u0001\"");
+}
+
+TEST(string_body_still_works) {
+  static char buf[1024];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 3);
+  MockState m;
+  
+  CHECK(body(roundtrip(rest, m, "GET /legacy HTTP/1.1\r\n\r\n")) == "plain 7");
+  rest.writer_buffer_size(128);
+  CHECK(body(roundtrip(rest, m, "GET /legacy HTTP/1.1\r\n\r\n")) == "plain 7");
+}
+
+TEST(writer_area_is_taken_from_request_buffer) {
+  static char buf[1024];
+  RESTful rest(buf, sizeof(buf), 64, handlers, 3);
+  int total = rest.buffer_size();
+  
+  rest.writer_buffer_size(300);
+  CHECK(rest.buffer_size() + rest.writer_buffer_size() == total);
+  rest.writer_buffer_size(total);
+  CHECK(rest.writer_buffer_size() == 300);
+}